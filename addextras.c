@@ -21,26 +21,24 @@
 #include "matrix2png.h"
 #include "string.h"
 
+/* The following are 'reasonable' settings. For discrete mappings,
+   the text is always vertical for horizontal scale bars. (but here
+   we set the scale bar to be vertical for discrete. */
+#define SCALEBARVERTICAL(matrixInfo) (FALSE || (matrixInfo)->discreteMap != NULL) // todo: make this user-settable
+#define SCALEBARMIDVAL FALSE // todo: make this user-settable (?)
+#define SCALEBARROTATELABELS FALSE // option only applies if scalebar is horizontal : todo: make this user-settable.
+
 /*****************************************************************************
- * addScaleBar
+ * layoutScaleBar
  *****************************************************************************/
-void addScaleBar(gdImagePtr img, MATRIXINFO_T* matrixInfo)
+void layoutScaleBar(LAYOUT_T* layout, FEATURE_T* feature, MATRIXINFO_T* matrixInfo)
 {
-  int x, y, xoffset, yoffset; /* the offsets are where the actual scale bar starts, exclusive of labels */
   int featureWidth, featureHeight;
-  int barWidth, barHeight;
+  int barWidth;
   int xtotaloffset, ytotaloffset;
-  double blocksize;
-
-  
-  // The following are 'reasonable' settings. For discrete mappings,
-  // the text is always vertical for horizontal scale bars. (but here
-  // we set the scale bar to be vertical for discrete.
-  BOOLEAN_T vertical = FALSE || matrixInfo->discreteMap != NULL; // todo: make this user-settable
-  BOOLEAN_T includeMidVal = FALSE; // todo: make this user-settable (?)
-  BOOLEAN_T rotateLabels = FALSE; // option only applies if scalebar is horizontal : todo: make this user-settable.
+  BOOLEAN_T vertical = SCALEBARVERTICAL(matrixInfo);
 
-  DEBUG_CODE(1, fprintf(stderr, "--Adding scale bar\n"););
+  DEBUG_CODE(1, fprintf(stderr, "--Laying out scale bar\n"););
 
   /* calclute the space needed for the color bar */
   barWidth  = DEFAULTSCALEBARLENGTH;
@@ -60,131 +58,220 @@ void addScaleBar(gdImagePtr img, MATRIXINFO_T* matrixInfo)
     }
     DEBUG_CODE(1, fprintf(stderr, "Scale bar width will be %d for %d colors and %d defaults\n", barWidth, matrixInfo->discreteMap->count, SKIPDEFAULT ? 0 : 1););
   }
-  barHeight = DEFAULTSCALEBARHEIGHT;
-
-  /* get the total size including labels and padding */
-  getTotalScaleBarDims(TRUE, includeMidVal, vertical, rotateLabels, barWidth, barHeight, 
-			 matrixInfo, &featureWidth, &featureHeight, &xoffset, &yoffset);
-
-  placeFeature(img,
-	       "topleft", // todo: make this user-settable.
-	       TRUE,  // align.
-	       &x, &y, /* these will contain the positions for the _entire_ scale bar, including labels */
-	       matrixInfo->usedRegion,
-	       featureWidth+xoffset, featureHeight,
-	       &xtotaloffset, &ytotaloffset // this is how much we had to move everything
-	       );
-
-  matrixInfo->ulx += xtotaloffset;
-  matrixInfo->uly += ytotaloffset;
-  matrixInfo->lrx += xtotaloffset;
-  matrixInfo->lry += ytotaloffset;
-
-  DEBUG_CODE(1, fprintf(stderr, "Adding scale bar of length %d at %d %d, %d by %d, offset %d %d\n", barWidth, x, y, featureWidth, featureHeight, xoffset, yoffset););
-  drawScaleBar(img, vertical, x+xoffset, y+yoffset, barHeight, barWidth, &blocksize, matrixInfo);
-  labelScaleBar(img, includeMidVal, vertical, rotateLabels, x+xoffset, y+yoffset, barHeight, barWidth, blocksize, matrixInfo);
+  feature->length = barWidth;
+
+  /* get the total size including labels and padding; the offsets
+     are where the actual scale bar starts, exclusive of labels */
+  getTotalScaleBarDims(TRUE, SCALEBARMIDVAL, vertical, SCALEBARROTATELABELS, barWidth, DEFAULTSCALEBARHEIGHT,
+			 matrixInfo, &featureWidth, &featureHeight, &feature->xoffset, &feature->yoffset);
+
+  layoutFeature(layout,
+		"topleft", // todo: make this user-settable.
+		TRUE,  // align.
+		&feature->x, &feature->y, /* these will contain the positions for the _entire_ scale bar, including labels */
+		matrixInfo->usedRegion,
+		featureWidth+feature->xoffset, featureHeight,
+		&xtotaloffset, &ytotaloffset // this is how much we had to move everything
+		);
+  feature->width = featureWidth;
+  feature->height = featureHeight;
+} /* layoutScaleBar */
+
+
+/*****************************************************************************
+ * addScaleBar - draw a scale bar planned by layoutScaleBar.
+ *****************************************************************************/
+void addScaleBar(gdImagePtr img, FEATURE_T* feature, MATRIXINFO_T* matrixInfo)
+{
+  double blocksize;
+  BOOLEAN_T vertical = SCALEBARVERTICAL(matrixInfo);
+  int x = feature->x + feature->xoffset;
+  int y = feature->y + feature->yoffset;
+
+  DEBUG_CODE(1, fprintf(stderr, "Adding scale bar of length %d at %d %d, %d by %d, offset %d %d\n", feature->length, feature->x, feature->y, feature->width, feature->height, feature->xoffset, feature->yoffset););
+  drawScaleBar(img, vertical, x, y, DEFAULTSCALEBARHEIGHT, feature->length, &blocksize, matrixInfo);
+  labelScaleBar(img, SCALEBARMIDVAL, vertical, SCALEBARROTATELABELS, x, y, DEFAULTSCALEBARHEIGHT, feature->length, blocksize, matrixInfo);
+  if (matrixInfo->scaleHistogram && matrixInfo->discreteMap == NULL && !vertical) {
+    drawScaleBarHistogram(img, x, y+DEFAULTSCALEBARHEIGHT+PADDING, feature->length, SCALEBARHISTOGRAMHEIGHT, blocksize, matrixInfo);
+  }
 
 } /* addScaleBar */
 
 
 /*****************************************************************************
- * addRowLabels - put row label text on a picture.
+ * chooseShownLabels - for labels pitch pixels apart in a font
+ * textHeight high, which may be more than the pitch: going along the
+ * candidates (all of them if NULL), take each one that doesn't
+ * overlap the last one taken or stick out past either end. The labels
+ * are centered on their rows (or columns); shift is how far that
+ * moves them.
  *****************************************************************************/
-void addRowLabels(gdImagePtr img, STRING_LIST_T* rowLabels, 
-		  MATRIXINFO_T* matrixInfo)
+static BOOLEAN_T* chooseShownLabels(int numLabels, int pitch, int textHeight,
+				    BOOLEAN_T* candidates, int* shift)
+{
+  BOOLEAN_T* shown;
+  int i, top;
+  int nextFree = 0;
+  int numShown = 0;
+
+  shown = (BOOLEAN_T*)mycalloc(numLabels, sizeof(BOOLEAN_T));
+  *shift = pitch < textHeight ? (pitch - textHeight)/2 : 0;
+  for (i=0; i<numLabels; i++) {
+    if (candidates != NULL && !candidates[i]) continue;
+    top = i*pitch + *shift;
+    if (top < nextFree || top + textHeight > numLabels*pitch) continue;
+    shown[i] = TRUE;
+    nextFree = top + textHeight;
+    numShown++;
+  }
+  if (verbosity > NORMAL_VERBOSE) {
+    fprintf(stderr, "Labeling %d of %d\n", numShown, numLabels);
+  }
+  return shown;
+} /* chooseShownLabels */
+
+
+/*****************************************************************************
+ * chooseLabelFont - the font for labels pitch pixels apart: the -font
+ * font if there is one and it loads, at the largest size that fits
+ * (up to that of gdFontLarge), otherwise the largest built-in font that
+ * fits, or the tiny one if none do. Returns the height of a line.
+ *****************************************************************************/
+static int chooseLabelFont(int pitch, BOOLEAN_T vertical,
+			   MATRIXINFO_T* matrixInfo, FEATURE_T* feature)
+{
+  feature->font = NULL;
+  feature->ttfont = NULL;
+  if (matrixInfo->fontName != NULL) {
+    feature->ttfont = getTTFont(matrixInfo->fontName, pitch < gdFontLarge->h ? pitch : gdFontLarge->h, vertical);
+  }
+  if (feature->ttfont != NULL) {
+    return feature->ttfont->height;
+  }
+
+  if (pitch < gdFontSmall->h) feature->font = gdFontTiny;
+  else if (pitch < gdFontLarge->h) feature->font = gdFontSmall;
+  else feature->font = gdFontLarge;
+  return feature->font->h;
+} /* chooseLabelFont */
+
+
+/*****************************************************************************
+ * layoutRowLabels - make room for row label text.
+ *****************************************************************************/
+void layoutRowLabels(LAYOUT_T* layout, FEATURE_T* feature,
+		     STRING_LIST_T* rowLabels, 
+		     MATRIXINFO_T* matrixInfo)
 {
   int textWidth;
   int textHeight;
-  int linespacing, initX, initY;
   int xoffset, yoffset;
-  BOOLEAN_T rightJustify = FALSE;
-  gdFontPtr font = NULL;
+  int fontHeight;
   /* make sure the text and the ysize are _exactly_ the same. Choose the appropriate font, up to large */
   int yBlockSize = matrixInfo->yblocksize;
 
-  DEBUG_CODE(1, fprintf(stderr, "--- add row labels\n"););
+  DEBUG_CODE(1, fprintf(stderr, "--- lay out row labels\n"););
 
   if (matrixInfo->dividers) {
     yBlockSize++;
   }
-  if (yBlockSize < gdFontTiny->h) die("Can't fit the row label text with this block size (must be at least %d)", (int)gdFontTiny->h);
-  else if (yBlockSize < gdFontSmall->h) font = gdFontTiny;
-  else if (yBlockSize < gdFontLarge->h) font = gdFontSmall;
-  else font = gdFontLarge;
+  fontHeight = chooseLabelFont(yBlockSize, FALSE, matrixInfo, feature);
+  if (yBlockSize < fontHeight && !matrixInfo->thinLabels) die("Can't fit the row label text with this block size (must be at least %d, or use -thin)", fontHeight);
   
   DEBUG_CODE(1, fprintf(stderr, "Max string is %d\n", max_string_length(rowLabels)););
-  linespacing = yBlockSize - font->h;
-  DEBUG_CODE(1, if(linespacing<0) die("Linespacing is < 0"););
+  feature->linespacing = yBlockSize - fontHeight;
+  DEBUG_CODE(1, if(feature->linespacing<0 && !matrixInfo->thinLabels) die("Linespacing is < 0"););
+  feature->shown = NULL;
+  feature->shift = 0;
+  if (matrixInfo->thinLabels) {
+    feature->shown = chooseShownLabels(matrixInfo->rowsToUse, yBlockSize, fontHeight, matrixInfo->rowLabelCandidates, &feature->shift);
+  }
 
-  calcTextDimensions(rowLabels, matrixInfo->rowsToUse, FALSE, 0, linespacing, font, &textWidth, &textHeight); /* we do this again, in stringlist2image */
+  calcTextDimensions(rowLabels, matrixInfo->rowsToUse, FALSE, 0, feature->linespacing, feature->font, feature->ttfont, &textWidth, &textHeight); /* we do this again, in stringlist2image */
   DEBUG_CODE(1, fprintf(stderr, "Adding row labels with text width=%d height=%d\n", textWidth, textHeight););
+  feature->width = textWidth + TEXTPADDING;
+  feature->height = textHeight;
 
   if (matrixInfo->rowLabelsLeft) {
-    placeFeature(img, "leftmiddle", TRUE, &initX, &initY, matrixInfo->usedRegion, textWidth + TEXTPADDING, textHeight, &xoffset, &yoffset);
-    /* repaint the text background, as for some reason we get 1 pixel of garbage exposed (roundoff?). Color index 0 is always the background. */
-    gdImageFilledRectangle(img, initX, initY, textWidth + TEXTPADDING, textHeight, 0);
-    rightJustify = matrixInfo->reverseJustification ? FALSE : TRUE;
+    layoutFeature(layout, "leftmiddle", TRUE, &feature->x, &feature->y, matrixInfo->usedRegion, feature->width, feature->height, &xoffset, &yoffset);
+    feature->justify = matrixInfo->reverseJustification ? FALSE : TRUE;
   } else {
-    placeFeature(img, "rightmiddle", TRUE, &initX, &initY, matrixInfo->usedRegion, textWidth + TEXTPADDING, textHeight, &xoffset, &yoffset);
-    rightJustify = matrixInfo->reverseJustification ? TRUE : FALSE;
+    layoutFeature(layout, "rightmiddle", TRUE, &feature->x, &feature->y, matrixInfo->usedRegion, feature->width, feature->height, &xoffset, &yoffset);
+    feature->justify = matrixInfo->reverseJustification ? TRUE : FALSE;
   }
+} /* layoutRowLabels */
 
-  matrixInfo->ulx += xoffset;
-  matrixInfo->uly += yoffset;
-  matrixInfo->lrx += xoffset;
-  matrixInfo->lry += yoffset;
-  stringlist2image(img, rowLabels, matrixInfo->rowsToUse, rightJustify, FALSE /* vertical */, TEXTPADDING, linespacing, initX, initY, font);
 
+/*****************************************************************************
+ * addRowLabels - put row label text on a picture.
+ *****************************************************************************/
+void addRowLabels(gdImagePtr img, STRING_LIST_T* rowLabels, 
+		  FEATURE_T* feature, MATRIXINFO_T* matrixInfo)
+{
+  DEBUG_CODE(1, fprintf(stderr, "--- add row labels\n"););
+  stringlist2image(img, rowLabels, matrixInfo->rowsToUse, feature->shown, feature->justify, FALSE /* vertical */, TEXTPADDING, feature->linespacing, feature->x, feature->y + feature->shift, feature->font, feature->ttfont);
+  myfree(feature->shown);
   DEBUG_CODE(1, fprintf(stderr, "--- finished row labels\n"););
 } /* addRowLabels */
 
 
 /*****************************************************************************
- * addColLabels
+ * layoutColLabels
  *****************************************************************************/
-void addColLabels(gdImagePtr img, STRING_LIST_T* colLabels, 
-		  MATRIXINFO_T* matrixInfo)
+void layoutColLabels(LAYOUT_T* layout, FEATURE_T* feature,
+		     STRING_LIST_T* colLabels, 
+		     MATRIXINFO_T* matrixInfo)
 {
   int textWidth;
   int textHeight;
-  int linespacing, initX, initY;
   int xoffset, yoffset;
-  gdFontPtr font = NULL;
+  int matrixLeft = matrixInfo->ulx;
+  int fontHeight;
   /* make sure the text and the ysize are _exactly_ the same. Choose the appropriate font, up to large */
   int xBlockSize = matrixInfo->xblocksize;
   if (matrixInfo->dividers) {
     xBlockSize++;
   }
-  if (xBlockSize < gdFontTiny->h) die("Can't fit the column label text with this block size (must be at least %d)", (int)gdFontTiny->h);
-  else if (xBlockSize < gdFontSmall->h) font = gdFontTiny;
-  else if (xBlockSize < gdFontLarge->h) font = gdFontSmall;
-  else font = gdFontLarge;
+  fontHeight = chooseLabelFont(xBlockSize, TRUE, matrixInfo, feature);
+  if (xBlockSize < fontHeight && !matrixInfo->thinLabels) die("Can't fit the column label text with this block size (must be at least %d, or use -thin)", fontHeight);
   
   DEBUG_CODE(1, fprintf(stderr, "Max string is %d\n", max_string_length(colLabels)););
-  linespacing = xBlockSize - font->h;
-  DEBUG_CODE(1, if(linespacing<0) die("Linespacing is < 0"););
+  feature->linespacing = xBlockSize - fontHeight;
+  DEBUG_CODE(1, if(feature->linespacing<0 && !matrixInfo->thinLabels) die("Linespacing is < 0"););
+  feature->shown = NULL;
+  feature->shift = 0;
+  if (matrixInfo->thinLabels) {
+    feature->shown = chooseShownLabels(matrixInfo->numcols, xBlockSize, fontHeight, matrixInfo->colLabelCandidates, &feature->shift);
+  }
 
-  calcTextDimensions(colLabels, matrixInfo->numcols, TRUE, 0, linespacing, font, &textWidth, &textHeight); /* we do this again, in stringlist2image */
+  calcTextDimensions(colLabels, matrixInfo->numcols, TRUE, 0, feature->linespacing, feature->font, feature->ttfont, &textWidth, &textHeight); /* we do this again, in stringlist2image */
+  feature->width = textWidth;
+  feature->height = textHeight + TEXTPADDING*2;
+  feature->justify = matrixInfo->colLabelsBottom;
 
   if (matrixInfo->colLabelsBottom) {
-    placeFeature(img, "bottomleft", TRUE, &initX, &initY, matrixInfo->usedRegion, textWidth, textHeight + TEXTPADDING*2, &xoffset, &yoffset);
+    layoutFeature(layout, "bottomleft", TRUE, &feature->x, &feature->y, matrixInfo->usedRegion, feature->width, feature->height, &xoffset, &yoffset);
   } else {
-    placeFeature(img, "topleft", TRUE, &initX, &initY, matrixInfo->usedRegion, textWidth, textHeight + TEXTPADDING*2, &xoffset, &yoffset);
+    layoutFeature(layout, "topleft", TRUE, &feature->x, &feature->y, matrixInfo->usedRegion, feature->width, feature->height, &xoffset, &yoffset);
   }
 
   if (matrixInfo->rowLabelsLeft) {
     /* increase initX by offset used for row labels. */
-    initX += matrixInfo->ulx;
+    feature->x += matrixLeft;
   }
 
-  DEBUG_CODE(1, fprintf(stderr, "Adding col labels width=%d height=%d startX=%d startY=%d\n", textWidth, textHeight, initX, initY););
+  DEBUG_CODE(1, fprintf(stderr, "Laid out col labels width=%d height=%d startX=%d startY=%d\n", textWidth, textHeight, feature->x, feature->y););
+} /* layoutColLabels */
 
-  matrixInfo->ulx += xoffset;
-  matrixInfo->uly += yoffset;
-  matrixInfo->lrx += xoffset;
-  matrixInfo->lry += yoffset;
 
-  stringlist2image(img, colLabels, matrixInfo->numcols, matrixInfo->colLabelsBottom, TRUE, TEXTPADDING, linespacing, initX, initY, font);
+/*****************************************************************************
+ * addColLabels
+ *****************************************************************************/
+void addColLabels(gdImagePtr img, STRING_LIST_T* colLabels, 
+		  FEATURE_T* feature, MATRIXINFO_T* matrixInfo)
+{
+  stringlist2image(img, colLabels, matrixInfo->numcols, feature->shown, feature->justify, TRUE, TEXTPADDING, feature->linespacing, feature->x + feature->shift, feature->y, feature->font, feature->ttfont);
+  myfree(feature->shown);
 } /* addColLabels */
 
 
@@ -265,28 +352,32 @@ gdImagePtr addHighlight(gdImagePtr img,
 
 
 
+/*****************************************************************************
+ * Make room for a title at the top center of the image.
+ *****************************************************************************/
+void layoutTitle(LAYOUT_T* layout, FEATURE_T* feature, MATRIXINFO_T* matrixInfo, char* titleText)
+{
+  int xoff, yoff;
+  feature->font = gdFontLarge;
+  feature->width = strlen(titleText)* feature->font->w + 2*TEXTPADDING;
+  feature->height = feature->font->h + 2* TEXTPADDING;
+
+  layoutFeature(layout, "topmiddle", TRUE, &feature->x, &feature->y, matrixInfo->usedRegion, feature->width, feature->height, &xoff, &yoff);
+} /* layoutTitle */
+
+
 /*****************************************************************************
  * Add a title to the top center of the image.
  *****************************************************************************/
-void addTitle(gdImagePtr img, MATRIXINFO_T* matrixInfo, char* titleText)
+void addTitle(gdImagePtr img, FEATURE_T* feature, char* titleText)
 {
-  gdFontPtr font = gdFontLarge;
-  int width = strlen(titleText)* font->w + 2*TEXTPADDING;
-  int height = font->h + 2* TEXTPADDING;
-  int x, y, xoff, yoff;
   int textIntensity, textColor;
   textIntensity = chooseContrastingColor(img);
   textColor = gdImageColorClosest(img, textIntensity, textIntensity, textIntensity);
 
-  placeFeature(img, "topmiddle", TRUE, &x, &y, matrixInfo->usedRegion, width, height, &xoff, &yoff);
-  matrixInfo->ulx += xoff;
-  matrixInfo->uly += yoff;
-  matrixInfo->lrx += xoff;
-  matrixInfo->lry += yoff;
-
-  gdImageString(img, font, x, y, (unsigned char*)titleText, textColor);
+  gdImageString(img, feature->font, feature->x, feature->y, (unsigned char*)titleText, textColor);
 
-}
+} /* addTitle */
 
 
 /*****************************************************************************
@@ -13,27 +13,68 @@
 #include "gd.h"
 #include "locations.h"
 #include "matrix2png.h"
+#include "ttfont.h"
+
+/*****************************************************************************
+ * A feature laid out with one of the layout functions below, which
+ * measure it and plan its place on the image (see layoutFeature), to
+ * be drawn by the matching add function once the image has been made
+ * at its final size.
+ *****************************************************************************/
+typedef struct feature_t {
+  int x;  /* upper left of the whole feature, final once laid out */
+  int y;
+  int width;
+  int height;
+  int xoffset; /* scale bar: where the bar itself starts, past its labels */
+  int yoffset;
+  int length;  /* scale bar length */
+  int linespacing; /* text */
+  BOOLEAN_T justify; /* text: right (row labels) or bottom (column labels) justified */
+  gdFontPtr font;
+  TTFONT_T* ttfont; /* text: the -font font, used instead of font if not NULL */
+  BOOLEAN_T* shown; /* text: the labels drawn, or NULL for all of them */
+  int shift; /* text: how far shown labels are moved to center them on their rows or columns */
+} FEATURE_T;
+
 
 /*****************************************************************************
  * addScaleBar
  *****************************************************************************/
+void layoutScaleBar(LAYOUT_T* layout,
+		    FEATURE_T* feature,
+		    MATRIXINFO_T* matrixInfo);
+
 void addScaleBar(gdImagePtr img, 
+		 FEATURE_T* feature,
 		 MATRIXINFO_T* matrixInfo);
 
 
 /*****************************************************************************
  * addRowLabels
  *****************************************************************************/
+void layoutRowLabels(LAYOUT_T* layout,
+		     FEATURE_T* feature,
+		     STRING_LIST_T* rowLabels, 
+		     MATRIXINFO_T* matrixInfo);
+
 void addRowLabels(gdImagePtr img, 
 		  STRING_LIST_T* rowLabels, 
+		  FEATURE_T* feature,
 		  MATRIXINFO_T* matrixInfo);
 
 
 /*****************************************************************************
  * addColLabels
  *****************************************************************************/
+void layoutColLabels(LAYOUT_T* layout,
+		     FEATURE_T* feature,
+		     STRING_LIST_T* colLabels, 
+		     MATRIXINFO_T* matrixInfo);
+
 void addColLabels(gdImagePtr img, 
 		  STRING_LIST_T* colLabels, 
+		  FEATURE_T* feature,
 		  MATRIXINFO_T* matrixInfo);
 
 
@@ -51,7 +92,9 @@ gdImagePtr addHighlight(gdImagePtr img,
 
 
 /* add a title to the image */
-void addTitle(gdImagePtr img, 	MATRIXINFO_T* matrixInfo, char* titleText);
+void layoutTitle(LAYOUT_T* layout, FEATURE_T* feature, MATRIXINFO_T* matrixInfo, char* titleText);
+
+void addTitle(gdImagePtr img, FEATURE_T* feature, char* titleText);
 
 /*****************************************************************************
  * restoreRegion: used after highlighting a region, and we want to
@@ -417,6 +417,86 @@ void sort_array
   }
 }
 
+/***********************************************************************
+ * Stable sort order of the items in an array.
+ *
+ * A bottom-up merge sort of item indices: short runs are sorted by
+ * insertion, then runs are merged pairwise, doubling in length each
+ * pass, with the merges of a pass shared among threads. Missing
+ * values go at the end whichever the direction.
+ ***********************************************************************/
+#define SORT_RUN 32
+
+/* Should item a come after item b? */
+#define SORT_AFTER(a, b) \
+  (isnan(items[a]) ? !isnan(items[b]) \
+   : (!isnan(items[b]) && (reverse_sort ? items[a] < items[b] : items[a] > items[b])))
+
+int* get_sort_order
+  (BOOLEAN_T reverse_sort,
+   ARRAY_T*  array)
+{
+  ATYPE* items;
+  int num_items;
+  int num_runs;
+  int width;
+  int i_run;
+  int* order;
+  int* other;
+
+  check_null_array(array);
+  items = array->items;
+  num_items = array->num_items;
+  order = (int*)mymalloc(sizeof(int) * (num_items + 1));
+  other = (int*)mymalloc(sizeof(int) * (num_items + 1));
+
+  num_runs = (num_items + SORT_RUN - 1) / SORT_RUN;
+#pragma omp parallel for schedule(static)
+  for (i_run = 0; i_run < num_runs; i_run++) {
+    int start = i_run * SORT_RUN;
+    int end = (start + SORT_RUN < num_items) ? start + SORT_RUN : num_items;
+    int i, j;
+
+    for (i = start; i < end; i++) {
+      int item = i;
+      for (j = i; j > start && SORT_AFTER(order[j - 1], item); j--) {
+	order[j] = order[j - 1];
+      }
+      order[j] = item;
+    }
+  }
+
+  for (width = SORT_RUN; width < num_items; width *= 2) {
+    int num_merges = (num_items + 2 * width - 1) / (2 * width);
+    int i_merge;
+    int* swap;
+
+#pragma omp parallel for schedule(static)
+    for (i_merge = 0; i_merge < num_merges; i_merge++) {
+      int start = i_merge * 2 * width;
+      int mid = (start + width < num_items) ? start + width : num_items;
+      int end = (mid + width < num_items) ? mid + width : num_items;
+      int i = start, j = mid, k = start;
+
+      while (i < mid && j < end) {
+	if (SORT_AFTER(order[i], order[j])) {
+	  other[k++] = order[j++];
+	} else {
+	  other[k++] = order[i++];
+	}
+      }
+      while (i < mid) other[k++] = order[i++];
+      while (j < end) other[k++] = order[j++];
+    }
+    swap = order;
+    order = other;
+    other = swap;
+  }
+
+  myfree(other);
+  return(order);
+}
+
 /***********************************************************************
  * Set and get the key used in sorting multiple arrays.
  ***********************************************************************/
@@ -531,33 +611,137 @@ double correlation_coeff
 }
 
 /***********************************************************************
- * Compute the median value in an array.
+ * Find the k-th smallest (counting from 0) of a list of values, by
+ * Hoare's selection algorithm: expected linear time, no sorting.
  *
- * Sorts the array as a side effect. TODO: make this behave correctly
- * with missing values.
+ * The values are partially reordered as a side effect. They must not
+ * include missing values.
  ***********************************************************************/
-ATYPE compute_median
-  (ARRAY_T* array)
+ATYPE select_kth_item
+  (int    k,
+   int    num_items,
+   ATYPE* items)
 {
-  int   num_items;
-  ATYPE return_value;
+  int   left = 0;
+  int   right = num_items - 1;
+  int   i_item;
+  int   j_item;
+  int   middle;
+  ATYPE pivot;
+  ATYPE temp;
 
-  /* Sort the array. */
-  sort_array(FALSE, array);
+  myassert(TRUE, k >= 0 && k < num_items,
+	   "Selecting item %d of %d.\n", k, num_items);
 
-  /* If there are an odd number of elements, return the middle one. */
-  num_items = get_array_length(array);
+  while (left < right) {
+    /* Median of three for the pivot, so sorted input isn't quadratic. */
+    middle = left + (right - left) / 2;
+    if (items[middle] < items[left]) {
+      temp = items[middle]; items[middle] = items[left]; items[left] = temp;
+    }
+    if (items[right] < items[left]) {
+      temp = items[right]; items[right] = items[left]; items[left] = temp;
+    }
+    if (items[right] < items[middle]) {
+      temp = items[right]; items[right] = items[middle]; items[middle] = temp;
+    }
+    pivot = items[middle];
+
+    i_item = left;
+    j_item = right;
+    while (i_item <= j_item) {
+      while (items[i_item] < pivot)
+	i_item++;
+      while (pivot < items[j_item])
+	j_item--;
+      if (i_item <= j_item) {
+	temp = items[i_item]; items[i_item] = items[j_item]; items[j_item] = temp;
+	i_item++;
+	j_item--;
+      }
+    }
+
+    /* Keep only the side that holds the k-th item. */
+    if (k <= j_item) {
+      right = j_item;
+    } else if (k >= i_item) {
+      left = i_item;
+    } else {
+      break;
+    }
+  }
+  return(items[k]);
+}
+
+/***********************************************************************
+ * Median of a list of values without missing values, by selection.
+ * The values are reordered.
+ ***********************************************************************/
+static ATYPE select_median
+  (int    num_items,
+   ATYPE* items)
+{
+  int   half = num_items / 2;
+  int   i_item;
+  ATYPE upper;
+  ATYPE lower;
+
+  upper = select_kth_item(half, num_items, items);
   if (num_items % 2 == 1) {
-    return_value = get_array_item(num_items / 2, array);
+    return(upper);
   }
 
-  /* Otherwise, return the average of the two middle ones. */
-  else {
-    return_value = get_array_item((num_items / 2) - 1, array);
-    return_value += get_array_item(num_items / 2, array);
-    return_value /= 2.0;
+  /* After selection everything below the upper middle is no larger
+     than it, so the lower middle is just the largest of those. */
+  lower = items[0];
+  for (i_item = 1; i_item < half; i_item++) {
+    if (items[i_item] > lower)
+      lower = items[i_item];
+  }
+  return((lower + upper) / 2.0);
+}
+
+/***********************************************************************
+ * Copy the non-missing values of an array into a buffer (which must
+ * be at least as long as the array). Returns how many were copied.
+ ***********************************************************************/
+static int copy_nonmissing
+  (ARRAY_T* array,
+   ATYPE*   buffer)
+{
+  int i_item;
+  int num_items;
+  int num_copied = 0;
+  ATYPE value;
+
+  num_items = get_array_length(array);
+  for (i_item = 0; i_item < num_items; i_item++) {
+    value = get_array_item(i_item, array);
+    if (isnan(value))
+      continue;
+    buffer[num_copied++] = value;
   }
+  return(num_copied);
+}
+
+/***********************************************************************
+ * Compute the median value in an array, ignoring missing values.
+ ***********************************************************************/
+ATYPE compute_median
+  (ARRAY_T* array)
+{
+  int    num_items;
+  ATYPE* scratch;
+  ATYPE  return_value;
 
+  check_null_array(array);
+  scratch = (ATYPE*)mymalloc(sizeof(ATYPE) * (get_array_length(array) + 1));
+  num_items = copy_nonmissing(array, scratch);
+  if (num_items == 0) {
+    die("Attempting to find the median of an empty array.\n");
+  }
+  return_value = select_median(num_items, scratch);
+  myfree(scratch);
   return(return_value);
 }
 
@@ -765,6 +949,54 @@ void variance_one_array
 }
 
 
+/***********************************************************************
+ * Center an array on its median and divide by its median absolute
+ * deviation (scaled by 1.4826, so that for normal data the result is
+ * comparable to a z-score). Missing values are left alone.
+ *
+ * The scratch buffer must hold at least as many items as the array.
+ * Returns FALSE if the MAD was zero, in which case the array is only
+ * centered.
+ ***********************************************************************/
+#define MAD_SCALE 1.4826
+BOOLEAN_T robust_scale_array
+  (ARRAY_T* array,
+   ATYPE*   scratch)
+{
+  int    i_item;
+  int    num_items;
+  int    num_present;
+  ATYPE  median;
+  ATYPE  mad;
+  ATYPE* items;
+
+  check_null_array(array);
+  num_items = get_array_length(array);
+  items = raw_array(array);
+
+  num_present = copy_nonmissing(array, scratch);
+  if (num_present == 0) {
+    return(TRUE); /* nothing to do */
+  }
+  median = select_median(num_present, scratch);
+
+  for (i_item = 0; i_item < num_present; i_item++) {
+    scratch[i_item] = fabs(scratch[i_item] - median);
+  }
+  mad = MAD_SCALE * select_median(num_present, scratch);
+
+  if (mad == 0.0) {
+    for (i_item = 0; i_item < num_items; i_item++) {
+      items[i_item] -= median;
+    }
+    return(FALSE);
+  }
+  for (i_item = 0; i_item < num_items; i_item++) {
+    items[i_item] = (items[i_item] - median) / mad;
+  }
+  return(TRUE);
+}
+
 /***********************************************************************
  * Mean center an array
  ***********************************************************************/
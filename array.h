@@ -199,6 +199,15 @@ void sort_array
   (BOOLEAN_T reverse_sort,
    ARRAY_T*  array);
 
+/***********************************************************************
+ * Return the order that sorts an array (stably, missing values last)
+ * without moving its elements: item order[i] belongs at position i.
+ * Caller frees the order.
+ ***********************************************************************/
+int* get_sort_order
+  (BOOLEAN_T reverse_sort,
+   ARRAY_T*  array);
+
 /***********************************************************************
  * Set and get the key used in sorting multiple arrays.
  ***********************************************************************/
@@ -223,9 +232,17 @@ ATYPE sum_of_square_diffs
    ARRAY_T* array2);
 
 /***********************************************************************
- * Compute the median value in an array.
- *
- * Sorts the array as a side effect.
+ * Find the k-th smallest (counting from 0) of a list of values in
+ * expected linear time. Reorders the values; no missing values
+ * allowed.
+ ***********************************************************************/
+ATYPE select_kth_item
+  (int    k,
+   int    num_items,
+   ATYPE* items);
+
+/***********************************************************************
+ * Compute the median value in an array, ignoring missing values.
  ***********************************************************************/
 ATYPE compute_median
   (ARRAY_T* array);
@@ -287,6 +304,15 @@ void sum_to_zero
 void variance_one_array
   (ARRAY_T* array);
 
+/***********************************************************************
+ * Center an array on its median and scale by its median absolute
+ * deviation. scratch must be as long as the array. Returns FALSE if
+ * the MAD is zero (the array is then only centered).
+ ***********************************************************************/
+BOOLEAN_T robust_scale_array
+  (ARRAY_T* array,
+   ATYPE*   scratch);
+
 /***********************************************************************
  * Mean center an array
  ***********************************************************************/
@@ -0,0 +1,184 @@
+/*****************************************************************************
+ * FILE: canvas.c
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: gd images whose pixels are one contiguous block, with
+ * room around them to grow into.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "canvas.h"
+#include "utils.h"
+#include "gd.h"
+
+/* The block behind a canvas: numRows rows of stride bytes, with the
+   image's pixel (0, 0) at originX, originY. Everything outside the
+   image is background (zero). */
+typedef struct canvas_t {
+  gdImagePtr     img;
+  unsigned char* block;
+  int            stride;
+  int            numRows;
+  int            originX;
+  int            originY;
+} CANVAS_T;
+
+/* The canvases in existence, so growCanvas and freeCanvas can tell
+   them from images gd allocated row by row. */
+static CANVAS_T canvases[MAXCANVASES];
+static int numCanvases = 0;
+
+static CANVAS_T* findCanvas(gdImagePtr img)
+{
+  int i;
+  for (i=0; i<numCanvases; i++) {
+    if (canvases[i].img == img)
+      return(&canvases[i]);
+  }
+  return(NULL);
+} /* findCanvas */
+
+
+/* Point the image's rows into the block, and update its size and
+   clipping rectangle to match. */
+static void setCanvasRows(CANVAS_T* canvas, int width, int height)
+{
+  int i;
+  gdImagePtr img = canvas->img;
+
+  if (height > img->sy || img->pixels == NULL) {
+    myfree(img->pixels);
+    img->pixels = (unsigned char**)mymalloc((height > 0 ? height : 1) * sizeof(unsigned char*));
+  }
+  for (i=0; i<height; i++) {
+    img->pixels[i] = canvas->block + (size_t)(canvas->originY + i) * canvas->stride + canvas->originX;
+  }
+  img->sx = width;
+  img->sy = height;
+#ifdef HAVE_GDIMAGESETCLIP
+  gdImageSetClip(img, 0, 0, width - 1, height - 1);
+#else
+  img->cx1 = 0;
+  img->cy1 = 0;
+  img->cx2 = width - 1;
+  img->cy2 = height - 1;
+#endif
+} /* setCanvasRows */
+
+
+/* Give the canvas a new block, width x height plus the reserve on
+   every side, all zero. */
+static void allocateCanvasBlock(CANVAS_T* canvas, int width, int height, int reserveX, int reserveY)
+{
+  canvas->stride = width + 2 * reserveX;
+  canvas->numRows = height + 2 * reserveY;
+  canvas->originX = reserveX;
+  canvas->originY = reserveY;
+  canvas->block = (unsigned char*)mycalloc((size_t)canvas->stride * canvas->numRows + 1, sizeof(unsigned char));
+} /* allocateCanvasBlock */
+
+
+/*****************************************************************************
+ * Make a canvas.
+ *****************************************************************************/
+gdImagePtr newCanvas(int width,
+		     int height,
+		     int reserveX,
+		     int reserveY)
+{
+  CANVAS_T* canvas;
+  int i;
+
+  if (numCanvases >= MAXCANVASES) die("Too many canvases (at most %d)", MAXCANVASES);
+  canvas = &canvases[numCanvases++];
+
+  /* gd sets up the rest of the image (palette and so on); only its
+     one pixel row is replaced */
+  canvas->img = gdImageCreate(1, 1);
+  for (i=0; i<canvas->img->sy; i++) {
+    myfree(canvas->img->pixels[i]);
+  }
+  myfree(canvas->img->pixels);
+  canvas->img->pixels = NULL;
+
+  allocateCanvasBlock(canvas, width, height, reserveX, reserveY);
+  setCanvasRows(canvas, width, height);
+  DEBUG_CODE(1, fprintf(stderr, "New canvas %d by %d, stride %d, %d rows\n", width, height, canvas->stride, canvas->numRows););
+  return(canvas->img);
+} /* newCanvas */
+
+
+/*****************************************************************************
+ * Grow a canvas.
+ *****************************************************************************/
+BOOLEAN_T growCanvas(gdImagePtr img,
+		     int newXSize,
+		     int newYSize,
+		     int Xplace,
+		     int Yplace)
+{
+  CANVAS_T* canvas = findCanvas(img);
+  int newOriginX, newOriginY;
+  int oldXSize, oldYSize;
+
+  if (canvas == NULL)
+    return(FALSE);
+
+  oldXSize = gdImageSX(img);
+  oldYSize = gdImageSY(img);
+  newOriginX = canvas->originX - Xplace;
+  newOriginY = canvas->originY - Yplace;
+
+  if (newOriginX >= 0 && newOriginY >= 0
+      && newOriginX + newXSize <= canvas->stride
+      && newOriginY + newYSize <= canvas->numRows) {
+    /* fits in the reserve, which is already background */
+    DEBUG_CODE(1, fprintf(stderr, "growCanvas: moving origin to %d %d\n", newOriginX, newOriginY););
+    canvas->originX = newOriginX;
+    canvas->originY = newOriginY;
+  } else {
+    unsigned char* oldBlock = canvas->block;
+    int oldStride = canvas->stride;
+    int oldOriginX = canvas->originX;
+    int oldOriginY = canvas->originY;
+    int i;
+
+    DEBUG_CODE(1, fprintf(stderr, "growCanvas: reallocating for %d by %d\n", newXSize, newYSize););
+    /* leave as much spare room on each side as it just grew by */
+    allocateCanvasBlock(canvas, newXSize, newYSize,
+			newXSize - oldXSize, newYSize - oldYSize);
+    for (i=0; i<oldYSize; i++) {
+      memcpy(canvas->block + (size_t)(canvas->originY + Yplace + i) * canvas->stride + canvas->originX + Xplace,
+	     oldBlock + (size_t)(oldOriginY + i) * oldStride + oldOriginX,
+	     oldXSize);
+    }
+    myfree(oldBlock);
+  }
+  setCanvasRows(canvas, newXSize, newYSize);
+  return(TRUE);
+} /* growCanvas */
+
+
+/*****************************************************************************
+ * Free a canvas.
+ *****************************************************************************/
+void freeCanvas(gdImagePtr img)
+{
+  CANVAS_T* canvas = findCanvas(img);
+
+  if (canvas == NULL) {
+    gdImageDestroy(img);
+    return;
+  }
+  myfree(canvas->block);
+  myfree(img->pixels);
+  img->pixels = NULL; /* so gd doesn't free the rows */
+  img->sy = 0;
+  gdImageDestroy(img);
+  *canvas = canvases[--numCanvases];
+} /* freeCanvas */
+
+/*
+ * canvas.c
+ */
@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * FILE: canvas.h
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: gd images whose pixels are one contiguous block, with
+ * room around them to grow into.
+ *****************************************************************************/
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include "utils.h"
+#include "gd.h"
+
+/* how many canvases can exist at once */
+#define MAXCANVASES 16
+
+/* spare room on each side of a canvas that is expected to grow */
+#define DEFAULTCANVASRESERVE 128
+
+/*****************************************************************************
+ * Make a palette image of width x height whose rows all lie in one
+ * zeroed block, rows apart by a fixed stride, with reserveX columns
+ * and reserveY rows spare on every side. The rows are still reached
+ * through img->pixels, so gd (including the PNG writer) works on it
+ * as usual. Free it with freeCanvas, not gdImageDestroy.
+ *****************************************************************************/
+gdImagePtr newCanvas(int width,
+		     int height,
+		     int reserveX,
+		     int reserveY);
+
+/*****************************************************************************
+ * Grow a canvas to newXSize x newYSize, with the existing image at
+ * Xplace, Yplace. Within the reserve this only moves the image's
+ * origin in the block; beyond it, the block is reallocated (with a
+ * fresh reserve) and each row copied once. Returns FALSE, doing
+ * nothing, if img was not made by newCanvas.
+ *****************************************************************************/
+BOOLEAN_T growCanvas(gdImagePtr img,
+		     int newXSize,
+		     int newYSize,
+		     int Xplace,
+		     int Yplace);
+
+void freeCanvas(gdImagePtr img);
+
+#endif /* CANVAS_H */
@@ -0,0 +1,285 @@
+/*****************************************************************************
+ * FILE: cluster.c
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Agglomerative hierarchical clustering (average or
+ * complete linkage) of matrix rows or columns.
+ *
+ * The pairwise distances are computed once, in parallel, into a
+ * condensed (upper triangle) array of floats; that is the memory
+ * bound, about 800Mb for 20000 variables. The tree is then built with
+ * the nearest-neighbor chain algorithm, which needs O(n^2) time and no
+ * memory beyond the distances, updating them in place with the
+ * Lance-Williams formulas as clusters merge.
+ *****************************************************************************/
+#include "cluster.h"
+#include "array.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* Position of the distance between i and j (i < j) in the condensed
+   array for n variables. */
+#define PAIR_INDEX(i, j, n) \
+  ((size_t)(i) * (n) - (size_t)(i) * ((i) + 1) / 2 + (size_t)((j) - (i) - 1))
+
+/*****************************************************************************
+ * Distance between two variables, in whichever order.
+ *****************************************************************************/
+static float pair_distance
+  (int    i,
+   int    j,
+   int    n,
+   float* distances)
+{
+  if (i < j) {
+    return(distances[PAIR_INDEX(i, j, n)]);
+  } else {
+    return(distances[PAIR_INDEX(j, i, n)]);
+  }
+}
+
+/*****************************************************************************
+ * All the pairwise distances between the variables.
+ *
+ * Correlation distance is 1 - r, with r computed as in
+ * correlation_matrix; a variable with no variance is taken to be
+ * uncorrelated with everything. Euclidean distance uses only the
+ * observations present in both variables, scaled up to the full
+ * number; pairs with nothing in common get the largest distance seen.
+ *****************************************************************************/
+static float* compute_distances
+  (BOOLEAN_T  by_cols,
+   distance_T distance,
+   MATRIX_T*  matrix,
+   int*       num_vars)
+{
+  int n;
+  int num_obs;
+  int i_var;
+  MTYPE* values;
+  BOOLEAN_T* flat;
+  float* distances;
+  float largest = 0.0;
+  BOOLEAN_T any_undefined = FALSE;
+
+  n = by_cols ? get_num_cols(matrix) : get_num_rows(matrix);
+  num_obs = by_cols ? get_num_rows(matrix) : get_num_cols(matrix);
+  *num_vars = n;
+
+  flat = (BOOLEAN_T*)mycalloc(n + 1, sizeof(BOOLEAN_T));
+  values = get_matrix_variables(by_cols, distance == corr_distance,
+				flat, matrix);
+  distances = (float*)mymalloc(sizeof(float) * ((size_t)n * (n - 1) / 2 + 1));
+
+  /* Rows near the top have the most pairs, hence the dynamic
+     schedule. */
+#pragma omp parallel for schedule(dynamic, 16) reduction(max:largest) reduction(||:any_undefined)
+  for (i_var = 0; i_var < n - 1; i_var++) {
+    MTYPE* var_i = &values[(size_t)i_var * num_obs];
+    float* out = &distances[PAIR_INDEX(i_var, i_var + 1, n)];
+    int j_var;
+    int k;
+
+    for (j_var = i_var + 1; j_var < n; j_var++) {
+      MTYPE* var_j = &values[(size_t)j_var * num_obs];
+      float dist;
+
+      if (distance == corr_distance) {
+	double dot = 0.0;
+	if (flat[i_var] || flat[j_var]) {
+	  dist = 1.0;
+	} else {
+	  for (k = 0; k < num_obs; k++) {
+	    dot += var_i[k] * var_j[k];
+	  }
+	  dist = 1.0 - dot;
+	  if (dist < 0.0) dist = 0.0;
+	}
+      } else {
+	double sum_sq = 0.0;
+	int count = 0;
+	for (k = 0; k < num_obs; k++) {
+	  if (!isnan(var_i[k]) && !isnan(var_j[k])) {
+	    double diff = var_i[k] - var_j[k];
+	    sum_sq += diff * diff;
+	    count++;
+	  }
+	}
+	if (count > 0) {
+	  dist = sqrt(sum_sq * num_obs / count);
+	} else {
+	  dist = -1.0;
+	  any_undefined = TRUE;
+	}
+      }
+      out[j_var - i_var - 1] = dist;
+      if (dist > largest) largest = dist;
+    }
+  }
+
+  if (any_undefined) {
+    size_t num_pairs = (size_t)n * (n - 1) / 2;
+    size_t i_pair;
+    if (verbosity > NORMAL_VERBOSE) {
+      fprintf(stderr, "Some pairs have no values in common; treating them as far apart.\n");
+    }
+    for (i_pair = 0; i_pair < num_pairs; i_pair++) {
+      if (distances[i_pair] < 0.0) distances[i_pair] = largest;
+    }
+  }
+
+  myfree(values);
+  myfree(flat);
+  return(distances);
+}
+
+/*****************************************************************************
+ * Read the leaves off the tree, left to right. Node ids below n are
+ * leaves; node n + m was made by merge m.
+ *****************************************************************************/
+static int* leaf_order
+  (int  n,
+   int* left,
+   int* right)
+{
+  int* order = (int*)mymalloc(sizeof(int) * (n + 1));
+  int* stack = (int*)mymalloc(sizeof(int) * (n + 1));
+  int num_stacked = 0;
+  int num_leaves = 0;
+
+  if (n == 1) {
+    order[0] = 0;
+  } else {
+    stack[num_stacked++] = 2 * n - 2;  /* the root */
+  }
+  while (num_stacked > 0) {
+    int node = stack[--num_stacked];
+    if (node < n) {
+      order[num_leaves++] = node;
+    } else {
+      stack[num_stacked++] = right[node - n];
+      stack[num_stacked++] = left[node - n];
+    }
+  }
+  myfree(stack);
+  return(order);
+}
+
+/*****************************************************************************
+ * Cluster the rows or columns of a matrix; return the leaf order.
+ *
+ * The chain is grown from any active cluster by repeatedly stepping to
+ * the nearest neighbor of its end until two clusters are each other's
+ * nearest neighbors; those are merged, and the rest of the chain stays
+ * valid for both linkages, so growth resumes from where it stopped.
+ * The merged cluster takes the slot of one of the pair.
+ *****************************************************************************/
+int* cluster_order
+  (BOOLEAN_T  by_cols,
+   linkage_T  linkage,
+   distance_T distance,
+   MATRIX_T*  matrix)
+{
+  int n;
+  float* distances;
+  int* chain;     /* slots on the chain */
+  int* size;      /* number of leaves in the cluster in each slot */
+  int* node;      /* tree node of the cluster in each slot */
+  int* left;      /* children of each merge */
+  int* right;
+  BOOLEAN_T* active;
+  int chain_length = 0;
+  int i_merge;
+  int* order;
+
+  distances = compute_distances(by_cols, distance, matrix, &n);
+  if (n == 0) {
+    myfree(distances);
+    return((int*)mymalloc(sizeof(int)));
+  }
+
+  chain = (int*)mymalloc(sizeof(int) * (n + 1));
+  size = (int*)mymalloc(sizeof(int) * (n + 1));
+  node = (int*)mymalloc(sizeof(int) * (n + 1));
+  left = (int*)mymalloc(sizeof(int) * (n + 1));
+  right = (int*)mymalloc(sizeof(int) * (n + 1));
+  active = (BOOLEAN_T*)mymalloc(sizeof(BOOLEAN_T) * (n + 1));
+  for (i_merge = 0; i_merge < n; i_merge++) {
+    size[i_merge] = 1;
+    node[i_merge] = i_merge;
+    active[i_merge] = TRUE;
+  }
+
+  for (i_merge = 0; i_merge < n - 1; i_merge++) {
+    int a, b, k;
+
+    if (chain_length == 0) {
+      for (a = 0; !active[a]; a++);
+      chain[chain_length++] = a;
+    }
+
+    /* Grow the chain until its last two links are mutual nearest
+       neighbors. Ties go to the previous link so that it stops. */
+    while (TRUE) {
+      float best;
+      a = chain[chain_length - 1];
+      if (chain_length > 1) {
+	b = chain[chain_length - 2];
+	best = pair_distance(a, b, n, distances);
+      } else {
+	b = -1;
+	best = FLT_MAX;
+      }
+      for (k = 0; k < n; k++) {
+	if (active[k] && k != a) {
+	  float dist = pair_distance(a, k, n, distances);
+	  if (dist < best || b == -1) {
+	    best = dist;
+	    b = k;
+	  }
+	}
+      }
+      if (chain_length > 1 && b == chain[chain_length - 2]) {
+	break;
+      }
+      chain[chain_length++] = b;
+    }
+    chain_length -= 2;
+
+    /* Merge b into a. */
+    left[i_merge] = node[a];
+    right[i_merge] = node[b];
+    for (k = 0; k < n; k++) {
+      if (active[k] && k != a && k != b) {
+	float* d_ak = &distances[a < k ? PAIR_INDEX(a, k, n) : PAIR_INDEX(k, a, n)];
+	float d_bk = pair_distance(b, k, n, distances);
+	if (linkage == average_linkage) {
+	  *d_ak = (size[a] * *d_ak + size[b] * d_bk) / (size[a] + size[b]);
+	} else if (d_bk > *d_ak) {
+	  *d_ak = d_bk;
+	}
+      }
+    }
+    size[a] += size[b];
+    node[a] = n + i_merge;
+    active[b] = FALSE;
+  }
+
+  order = leaf_order(n, left, right);
+
+  myfree(distances);
+  myfree(chain);
+  myfree(size);
+  myfree(node);
+  myfree(left);
+  myfree(right);
+  myfree(active);
+  return(order);
+}
+
+/*
+ * cluster.c
+ */
@@ -0,0 +1,29 @@
+/*****************************************************************************
+ * FILE: cluster.h
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Hierarchical clustering of the rows or columns of a
+ * matrix, used to choose the order in which they are drawn.
+ *****************************************************************************/
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "utils.h"
+#include "matrix.h"
+
+typedef enum {average_linkage, complete_linkage} linkage_T;
+typedef enum {corr_distance, euclid_distance} distance_T;
+
+/***********************************************************************
+ * Cluster the rows (or with by_cols, the columns) of a matrix and
+ * return the order of the leaves of the tree: drawing variable
+ * order[i] at position i puts similar variables next to each other.
+ * The caller frees the order.
+ ***********************************************************************/
+int* cluster_order
+  (BOOLEAN_T  by_cols,
+   linkage_T  linkage,
+   distance_T distance,
+   MATRIX_T*  matrix);
+
+#endif /* CLUSTER_H */
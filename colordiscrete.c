@@ -42,10 +42,8 @@ DISCRETEMAP_T* readDiscreteMap(FILE* file)
 	growDiscreteMap(return_value);
       }
       return_value->colors[return_value->count]->namedcolor = colorary[i];
-      return_value->values[return_value->count] = i;
-      return_value->consecints[return_value->count] = return_value->count; // we need this...
+      return_value->values[return_value->count] = i + 1; // data values start at 1
       sprintf(buf, "%d", return_value->count + 1);
-      insert(return_value->mapping, buf, &(return_value->consecints[return_value->count]));
       DEBUG_CODE(1, fprintf(stderr, "No label so got %s\n", buf););
       add_string(buf, return_value->labels); // use the integer value
       return_value->count++;
@@ -130,10 +128,7 @@ DISCRETEMAP_T* readDiscreteMap(FILE* file)
 	  add_string(buf, return_value->labels); // use the integer value
 	}
 	return_value->values[return_value->count] = one_value; 
-	return_value->consecints[return_value->count] = return_value->count; // we need this.. consecutive integers.
 	string2color(colorbuf, return_value->colors[return_value->count]);
-	sprintf(buf, "%d", return_value->values[return_value->count]); // convert int into a string.
-	insert(return_value->mapping, buf, &(return_value->consecints[return_value->count]));
 	return_value->count++;
       }
     }
@@ -142,10 +137,105 @@ DISCRETEMAP_T* readDiscreteMap(FILE* file)
       die("Too many colors chosen in discrete map"); // this isn't really possible since the number of colors in the palette is small.
     }
   }
+  compileDiscreteMap(return_value);
   return(return_value);
 }
 
 
+/*****************************************************************************
+ * Build the lookup table from values to map entries. When the values
+ * lie within DMAP_MAX_DENSE_SPAN of each other (the usual case: small
+ * consecutive codes) this is a plain array indexed by value - minKey;
+ * otherwise an open-addressed hash on the integer value. If a value
+ * is listed twice, the later entry wins.
+ *****************************************************************************/
+void compileDiscreteMap(DISCRETEMAP_T* dmap)
+{
+  int i;
+  int minKey, maxKey;
+
+  myfree(dmap->dense);
+  myfree(dmap->sparseKeys);
+  myfree(dmap->sparseIndex);
+  dmap->dense = NULL;
+  dmap->sparseKeys = NULL;
+  dmap->sparseIndex = NULL;
+  dmap->sparseSize = 0;
+  dmap->minKey = 0;
+  dmap->keySpan = 0;
+
+  if (dmap->count == 0)
+    return;
+
+  minKey = maxKey = dmap->values[0];
+  for (i=1; i<dmap->count; i++) {
+    if (dmap->values[i] < minKey) minKey = dmap->values[i];
+    if (dmap->values[i] > maxKey) maxKey = dmap->values[i];
+  }
+
+  if ((double)maxKey - (double)minKey < DMAP_MAX_DENSE_SPAN) {
+    dmap->minKey = minKey;
+    dmap->keySpan = maxKey - minKey + 1;
+    dmap->dense = (int*)mymalloc(sizeof(int)*dmap->keySpan);
+    for (i=0; i<dmap->keySpan; i++) {
+      dmap->dense[i] = -1;
+    }
+    for (i=0; i<dmap->count; i++) {
+      dmap->dense[dmap->values[i] - minKey] = i;
+    }
+    DEBUG_CODE(1, fprintf(stderr, "Discrete map: dense lookup over %d values from %d\n", dmap->keySpan, minKey););
+  } else {
+    /* at most half full, so probes stay short */
+    for (dmap->sparseSize = 16; dmap->sparseSize < 2 * dmap->count; dmap->sparseSize *= 2)
+      ;
+    dmap->sparseKeys = (int*)mymalloc(sizeof(int)*dmap->sparseSize);
+    dmap->sparseIndex = (int*)mymalloc(sizeof(int)*dmap->sparseSize);
+    for (i=0; i<dmap->sparseSize; i++) {
+      dmap->sparseIndex[i] = -1;
+    }
+    for (i=0; i<dmap->count; i++) {
+      int slot = DMAP_HASH_SLOT(dmap->values[i], dmap->sparseSize);
+      while (dmap->sparseIndex[slot] >= 0 && dmap->sparseKeys[slot] != dmap->values[i]) {
+	slot = (slot + 1) & (dmap->sparseSize - 1);
+      }
+      dmap->sparseKeys[slot] = dmap->values[i];
+      dmap->sparseIndex[slot] = i;
+    }
+    DEBUG_CODE(1, fprintf(stderr, "Discrete map: hashed lookup in %d slots\n", dmap->sparseSize););
+  }
+}
+
+
+/*****************************************************************************
+ * Which entry of the map is for this value (the data value cast to
+ * an int), or -1 if none is.
+ *****************************************************************************/
+int discreteMapIndex(int value, DISCRETEMAP_T* dmap)
+{
+  int slot;
+  unsigned int offset;
+
+  if (dmap->dense != NULL) {
+    /* unsigned, so value < minKey wraps around and fails the test too */
+    offset = (unsigned int)value - (unsigned int)dmap->minKey;
+    if (offset >= (unsigned int)dmap->keySpan)
+      return(-1);
+    return(dmap->dense[offset]);
+  }
+
+  if (dmap->sparseSize == 0)
+    return(-1);
+
+  slot = DMAP_HASH_SLOT(value, dmap->sparseSize);
+  while (dmap->sparseIndex[slot] >= 0) {
+    if (dmap->sparseKeys[slot] == value)
+      return(dmap->sparseIndex[slot]);
+    slot = (slot + 1) & (dmap->sparseSize - 1);
+  }
+  return(-1);
+}
+
+
 /*****************************************************************************
  * allocate memory and initialize a discrete mapping data structure
  *****************************************************************************/
@@ -157,7 +247,6 @@ DISCRETEMAP_T* allocateDiscreteMap(void)
   return_value = (DISCRETEMAP_T*)mymalloc(sizeof(DISCRETEMAP_T));
   return_value->colors = (colorV_T**)mymalloc(sizeof(colorV_T*)*DMAP_INITIAL_COUNT);
   return_value->values = (int*)mymalloc(sizeof(int)*DMAP_INITIAL_COUNT);
-  return_value->consecints = (int*)mymalloc(sizeof(int)*DMAP_INITIAL_COUNT);
 
   for (i=0; i<DMAP_INITIAL_COUNT; i++) {
     return_value->colors[i] = initColorVByName((color_T)0);
@@ -172,7 +261,12 @@ DISCRETEMAP_T* allocateDiscreteMap(void)
   return_value->count = 0;
   return_value->maxcount = DMAP_INITIAL_COUNT;
   return_value->usedValues = inittable(DMAP_INITIAL_COUNT);
-  return_value->mapping = inittable(DMAP_INITIAL_COUNT);
+  return_value->dense = NULL;
+  return_value->sparseKeys = NULL;
+  return_value->sparseIndex = NULL;
+  return_value->sparseSize = 0;
+  return_value->minKey = 0;
+  return_value->keySpan = 0;
   if (strlen(DEFAULT_DISCRETE_LABEL) > DEFAULT_DISCRETE_LABEL_BUFSIZE)
     die("Default discrete label is too long. Need to increase defined DEFAULT_DISCRETE_LABEL_BUFSIZE");
   strcpy(return_value->defaultlabel, DEFAULT_DISCRETE_LABEL);
@@ -192,9 +286,10 @@ void freeDiscreteMap(DISCRETEMAP_T* dmap) {
   free(dmap->default_colorcode);
   free(dmap->colors);
   freetable(dmap->usedValues);
-  freetable(dmap->mapping);
   free(dmap->values);
-  free(dmap->consecints);
+  myfree(dmap->dense);
+  myfree(dmap->sparseKeys);
+  myfree(dmap->sparseIndex);
   free(dmap);
 }
 
@@ -207,7 +302,6 @@ void growDiscreteMap(DISCRETEMAP_T* dmap) {
   int i;
   DEBUG_CODE(1, fprintf(stderr, "Growing map\n"););
   dmap->values = (int*)myrealloc(dmap->values, sizeof(int)*newsize);
-  dmap->consecints = (int*)myrealloc(dmap->consecints, sizeof(int)*newsize);
   dmap->colors = (colorV_T**)myrealloc(dmap->colors, newsize*sizeof(colorV_T*));
 
   for (i=dmap->count; i<newsize; i++) {
@@ -220,33 +314,62 @@ void growDiscreteMap(DISCRETEMAP_T* dmap) {
 }
 
 /*****************************************************************************
- * Check the data for actual use of the values. Used for scale bar
+ * Check the data for actual use of the values. Used for scale bar.
+ *
+ * The statistics already know which integer values occur, so only
+ * those need looking up in the map; the data itself is only scanned
+ * if the statistics gave up (too wide a range of values).
  *****************************************************************************/
 void checkDiscreteUsedValues(MATRIXINFO_T* matrixInfo)
 {
   int i,j;
   static int notnull = 1;
-  int* k;
+  int k;
   char buf[100];
-  matrixInfo->discreteMap->default_used = FALSE;
+  unsigned char* seen;
+  MATRIXSTATS_T* stats = matrixInfo->stats;
+  DISCRETEMAP_T* dmap = matrixInfo->discreteMap;
+  dmap->default_used = FALSE;
 
-  for (i=0; i<matrixInfo->numrows; i++) {
-    for(j=0; j<matrixInfo->numcols; j++) {
+  /* flag the map entries used, then record their values at the end */
+  seen = (unsigned char*)mycalloc(dmap->count + 1, sizeof(unsigned char));
 
-      if (isnan(get_matrix_cell(i,j,matrixInfo->matrix)))
+  if (stats != NULL && !stats->used_overflow) {
+    for (i=0; i<stats->used_span && stats->used != NULL; i++) {
+      if (!stats->used[i])
 	continue;
-      
-      sprintf(buf, "%d", (int)get_matrix_cell(i,j,matrixInfo->matrix));
-      k = (int*)find(matrixInfo->discreteMap->mapping, buf);
-      if (k == NULL) {
-	matrixInfo->discreteMap->default_used = TRUE;
-	//	DEBUG_CODE(1, fprintf(stderr, "Default is needed for %s\n", buf););
+
+      k = discreteMapIndex(stats->used_base + i, dmap);
+      if (k < 0) {
+	dmap->default_used = TRUE;
       } else {
-	insert(matrixInfo->discreteMap->usedValues, buf, &notnull);
-	//	DEBUG_CODE(1, fprintf(stderr, "Found usage of %s\n", buf););
+	seen[k] = 1;
       }
     }
+  } else {
+    for (i=0; i<matrixInfo->numrows; i++) {
+      for(j=0; j<matrixInfo->numcols; j++) {
+
+	if (isnan(get_matrix_cell(i,j,matrixInfo->matrix)))
+	  continue;
+      
+	k = discreteMapIndex((int)get_matrix_cell(i,j,matrixInfo->matrix), dmap);
+	if (k < 0) {
+	  dmap->default_used = TRUE;
+	} else {
+	  seen[k] = 1;
+	}
+      }
+    }
+  }
+
+  for (k=0; k<dmap->count; k++) {
+    if (seen[k]) {
+      sprintf(buf, "%d", dmap->values[k]);
+      insert(dmap->usedValues, buf, &notnull);
+    }
   }
+  myfree(seen);
   DEBUG_CODE(1, fprintf(stderr, "There are %d values used (not including the default)\n", matrixInfo->discreteMap->usedValues->num_items););
   DEBUG_CODE(1, fprintf(stderr, "The default %s used\n", matrixInfo->discreteMap->default_used ? "is" : "is not"););
 }
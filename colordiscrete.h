@@ -21,6 +21,12 @@
 #define DEFAULT_DISCRETE_COLOR "grey"
 #define MAX_DROW 1000
 
+/* Discrete maps whose values span fewer integers than this are looked
+   up in a flat array; wider ones in a small hash on the value. */
+#define DMAP_MAX_DENSE_SPAN 65536
+#define DMAP_HASH_SLOT(value, size) \
+  ((int)(((unsigned int)(value) * 2654435761U) >> 7) & ((size) - 1))
+
 /* Default discrete mapping, using as many of the predefined colors as
  *  possible. Designed so there is a reasonable chance that this will
  *  look okay. Don't use black and white because these are reasonbly
@@ -32,6 +38,8 @@ DISCRETEMAP_T* readDiscreteMap(FILE* file);
 DISCRETEMAP_T* allocateDiscreteMap(void);
 void freeDiscreteMap(DISCRETEMAP_T* dmap);
 void growDiscreteMap(DISCRETEMAP_T* dmap);
+void compileDiscreteMap(DISCRETEMAP_T* dmap);
+int discreteMapIndex(int value, DISCRETEMAP_T* dmap);
 void checkDiscreteUsedValues(MATRIXINFO_T* matrixInfo);
 void allocateColorsDiscrete (gdImagePtr img, 
 			     DISCRETEMAP_T* dmap, 
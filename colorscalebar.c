@@ -146,6 +146,11 @@ void getTotalScaleBarDims(BOOLEAN_T addLabels,
     }
   }
 
+  /* room for the histogram under the bar */
+  if (matrixInfo->scaleHistogram && matrixInfo->discreteMap == NULL && !vertical) {
+    *height += SCALEBARHISTOGRAMHEIGHT + PADDING;
+  }
+
   DEBUG_CODE(1, fprintf(stderr, 
 			"Total scale bar dimensions will be %d wide by %d high, x offset %d, y offset %d, labels is %d, vertical is %d, rotatelabels is %d\n", 
 			*width, *height, *widthoffset, *heightoffset, (int)addLabels, (int)vertical, (int)rotatelabels););
@@ -248,6 +253,49 @@ void drawScaleBar (
 } /* drawScaleBar */
 
 
+/*****************************************************************************
+ * drawScaleBarHistogram: show how the data is spread along the scale bar
+ *****************************************************************************/
+void drawScaleBarHistogram (
+			    gdImagePtr img,
+			    int xStart, /* all meas in pixels*/
+			    int yStart,
+			    int length,
+			    int height,
+			    double blockLength,
+			    MATRIXINFO_T* matrixInfo
+			    )
+{
+  long* counts;
+  long biggest;
+  int i, barHeight, colorcode;
+  int lastColor = gdImageColorsTotal(img) - 1;
+
+  if (matrixInfo->stats == NULL || length < 1 || height < 1)
+    return;
+
+  counts = (long*)mymalloc(sizeof(long)*length);
+  biggest = rebin_stats_histogram(matrixInfo->minval, matrixInfo->maxval, length, counts, matrixInfo->stats);
+  DEBUG_CODE(1, fprintf(stderr, "Histogram under scale bar: tallest bin has %ld values\n", biggest););
+
+  if (biggest > 0) {
+    for (i = 0; i < length; i++) {
+      if (counts[i] == 0)
+	continue;
+      /* round up so that every occupied bin shows */
+      barHeight = (int)ceil((double)counts[i] * height / biggest);
+      colorcode = (int)(i / blockLength) + NUMRESERVEDCOLORS;
+      if (colorcode > lastColor)
+	colorcode = lastColor;
+      gdImageLine(img, xStart + i, yStart + height - barHeight, xStart + i, yStart + height - 1, colorcode);
+    }
+  }
+  /* baseline */
+  gdImageLine(img, xStart - 1, yStart + height, xStart + length - 1, yStart + height, 2);
+  myfree(counts);
+} /* drawScaleBarHistogram */
+
+
 /*****************************************************************************
  * labelScaleBar: add text numerical labels to a scale bar							      
  *****************************************************************************/
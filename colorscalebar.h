@@ -42,6 +42,7 @@
 #define DEFAULTSCALEBARHEIGHT 8
 #define DEFAULTSCALEBARBLOCKSIZE 10
 #define PADDING 3 /* pixel padding for some text features */
+#define SCALEBARHISTOGRAMHEIGHT 24 /* height of the optional value histogram */
 
 /* add a scale bar to an image. Must designate where to put it. If
  * space was not allotted in the image for the scale bar. It uses the
@@ -58,6 +59,20 @@ void drawScaleBar (
 	       MATRIXINFO_T* matrixInfo
 	       );
 
+/* draw a histogram of the data values under a horizontal scale bar,
+ * one pixel column per position along the bar, each in the color of
+ * the bar at that point.
+ */
+void drawScaleBarHistogram (
+			    gdImagePtr img,
+			    int xStart, /* all meas in pixels*/
+			    int yStart,
+			    int length,
+			    int height,
+			    double blockLength,
+			    MATRIXINFO_T* matrixInfo
+			    );
+
 void checkScaleBarDims (
 			gdImagePtr img,
 			BOOLEAN_T vertical,
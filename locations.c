@@ -10,6 +10,7 @@
 #include "locations.h"
 #include "utils.h"
 #include "gd.h"
+#include "canvas.h"
 #include <string.h> /* memset, memmove */
 
 /*****************************************************************************
@@ -203,19 +204,13 @@ void findLocationCoords(LOCATION_T* location,
 /*****************************************************************************
  * Adjust coordinates to align with existing features.
  *****************************************************************************/
-void align(gdImagePtr img,
-	   char* locationAsString,
+void align(char* locationAsString,
 	   int *desiredupperLeftX, 
 	   int *desiredupperLeftY, 
 	   int featureWidth,  // we only need the width for justification
 	   USED_T* usedRegion)
 
 {
-  int imageXSize, imageYSize;
-
-  imageXSize = gdImageSX(img);
-  imageYSize = gdImageSY(img);
-
   /* the possibilities are: 
    * topmiddle, topleft, bottomleft, bottommiddle: move X only to the right by upperLeftXTaken
    * topright, bottomright: move x left by imageXsize - lowerRightXtaken
@@ -242,25 +237,26 @@ void align(gdImagePtr img,
 
 
 /*****************************************************************************
- * Find space for a new feature to be added to an image at a given
- * location. Resize the image if necessary. This requires knowing what
- * parts of the image are "taken" by existing features. This function
- * should be called before adding anything to an image that uses the
- * location structs to place items.
+ * Work out where a new feature goes on a canvas of the current size,
+ * and how the canvas must grow to take it: to newwidth x newheight,
+ * with what is there now moved to newstartX, newstartY. Returns TRUE
+ * if it has to grow. Shared by placeFeature, which grows the image
+ * straight away, and layoutFeature, which only plans it.
  *****************************************************************************/
-void placeFeature(gdImagePtr img, 
-		  char* locationAsString,
-		  BOOLEAN_T alignWithExisting, /* try to line it up with existing features */
-		  int* x,  /* where we will put the new features */
-		  int* y,
-		  USED_T* usedRegion,
-		  int featureWidth,
-		  int featureHeight,
-		  int *xoffset, int *yoffset)
+static BOOLEAN_T locateFeature(int currentXSize,
+			       int currentYSize,
+			       char* locationAsString,
+			       BOOLEAN_T alignWithExisting,
+			       int* x,
+			       int* y,
+			       USED_T* usedRegion,
+			       int featureWidth,
+			       int featureHeight,
+			       int *xoffset, int *yoffset,
+			       int *newwidth, int *newheight,
+			       int *newstartX, int *newstartY)
 {
-  int currentXSize, currentYSize;
   int desiredupperLeftX, desiredupperLeftY, desiredlowerRightX, desiredlowerRightY;
-  int newwidth, newheight, newstartX, newstartY;
   LOCATION_T** standardlocs;
   looseloc_T desiredlooseloc;
   LOCATION_T* desiredlocation;
@@ -275,9 +271,6 @@ void placeFeature(gdImagePtr img,
 
   DEBUG_CODE(1, fprintf(stderr, "Desired location is %s, alignWithExisting=%d\n", desiredlocation->description, (int)alignWithExisting););
 
-  /* figure out the size of the image */
-  currentXSize = gdImageSX(img);
-  currentYSize = gdImageSY(img);
   if (usedRegion->ulx >= 0) {
     naive = FALSE;
   }
@@ -291,16 +284,15 @@ void placeFeature(gdImagePtr img,
       if (featureWidth > currentXSize || featureHeight > currentYSize) {
 	/* resize the image */
 
-	newwidth = featureWidth > currentXSize ? featureWidth : currentXSize;
-	newheight = featureHeight > currentYSize ? featureHeight : currentYSize;
-	newstartX = featureWidth == newwidth ? 0 : (newwidth - featureWidth )/2;
-	newstartY = featureHeight == newheight ? 0 : (newheight - featureHeight)/2;
-	DEBUG_CODE(1, fprintf(stderr, "Resizing image to %d by %d\n", newwidth, newheight););
-
-	enlargeCanvas(img, newwidth, newheight, newstartX, newstartY);
+	*newwidth = featureWidth > currentXSize ? featureWidth : currentXSize;
+	*newheight = featureHeight > currentYSize ? featureHeight : currentYSize;
+	*newstartX = featureWidth == *newwidth ? 0 : (*newwidth - featureWidth )/2;
+	*newstartY = featureHeight == *newheight ? 0 : (*newheight - featureHeight)/2;
+	DEBUG_CODE(1, fprintf(stderr, "Resizing image to %d by %d\n", *newwidth, *newheight););
+	resize = TRUE;
 
-	*x = newstartX;
-	*y = newstartY;
+	*x = *newstartX;
+	*y = *newstartY;
 
       } else {
 	*x = (currentXSize - featureWidth)/2;
@@ -310,7 +302,8 @@ void placeFeature(gdImagePtr img,
       updateUsedRegion(usedRegion, *x, *y, *x + featureWidth, *y + featureHeight);
       *xoffset = *x;
       *yoffset = *y;
-      return;
+      freeStandardLocs(standardlocs);
+      return(resize);
     } else {
       die("Cannot use center on non-naive image");
     }
@@ -318,8 +311,8 @@ void placeFeature(gdImagePtr img,
 
   /* figure out where we would put it if we could put it anywhere we
      wanted, then move existing stuff around and finally resize the image as needed */
-  newstartX = usedRegion->ulx;
-  newstartY = usedRegion->uly;
+  *newstartX = usedRegion->ulx;
+  *newstartY = usedRegion->uly;
 
   findLocationCoords(desiredlocation, 
 		     usedRegion,
@@ -333,8 +326,7 @@ void placeFeature(gdImagePtr img,
 
   // this step just alters the dominant coordinate (x or y) to line up with what is there already.
   if (alignWithExisting && !naive) {
-    align(img,
-	  locationAsString,
+    align(locationAsString,
 	  &desiredupperLeftX, 
 	  &desiredupperLeftY, 
 	  featureWidth,
@@ -349,11 +341,11 @@ void placeFeature(gdImagePtr img,
      are negative or greater than the image size */
   if (desiredupperLeftX < 0 || desiredlowerRightX > currentXSize) {
     DEBUG_CODE(1, fprintf(stderr, "Adjusting width\n"););
-    newwidth = (desiredupperLeftX < 0 ? currentXSize - desiredupperLeftX : currentXSize) + (desiredlowerRightX > currentXSize ? desiredlowerRightX - currentXSize : 0);
+    *newwidth = (desiredupperLeftX < 0 ? currentXSize - desiredupperLeftX : currentXSize) + (desiredlowerRightX > currentXSize ? desiredlowerRightX - currentXSize : 0);
 
     if (desiredupperLeftX < 0) {
       /* adjust the coordinate by the difference */
-      newstartX -= desiredupperLeftX;
+      *newstartX -= desiredupperLeftX;
       desiredupperLeftX -= desiredupperLeftX;
 
     } else {
@@ -362,16 +354,16 @@ void placeFeature(gdImagePtr img,
     }
     resize = TRUE;
   } else {
-    newwidth = currentXSize;
+    *newwidth = currentXSize;
     //    newstartX = 0;
   }
 
   if (desiredupperLeftY < 0 || desiredlowerRightY > currentYSize) {
     DEBUG_CODE(1, fprintf(stderr, "Adjusting height\n"););
-    newheight = (desiredupperLeftY < 0 ? currentYSize - desiredupperLeftY : currentYSize) + (desiredlowerRightY > currentYSize ? desiredlowerRightY - currentYSize : 0);
+    *newheight = (desiredupperLeftY < 0 ? currentYSize - desiredupperLeftY : currentYSize) + (desiredlowerRightY > currentYSize ? desiredlowerRightY - currentYSize : 0);
 
     if (desiredupperLeftY < 0) {
-      newstartY -= desiredupperLeftY;
+      *newstartY -= desiredupperLeftY;
       desiredupperLeftY -= desiredupperLeftY;
 
     } else {
@@ -380,18 +372,16 @@ void placeFeature(gdImagePtr img,
     }
     resize = TRUE;
   } else {
-    newheight = currentYSize;
+    *newheight = currentYSize;
     //    newstartY = 0;
   }
 
-  DEBUG_CODE(1, fprintf(stderr, "New size will be %d x %d\n", newwidth, newheight););
-  DEBUG_CODE(1, fprintf(stderr, "Moving existing image to %d %d in the new image\n", newstartX, newstartY););
+  DEBUG_CODE(1, fprintf(stderr, "New size will be %d x %d\n", *newwidth, *newheight););
+  DEBUG_CODE(1, fprintf(stderr, "Moving existing image to %d %d in the new image\n", *newstartX, *newstartY););
 
   if (resize) {
-    DEBUG_CODE(1, fprintf(stderr, "Resizing\n"););
-    enlargeCanvas(img, newwidth, newheight, newstartX, newstartY);
-    *xoffset = newstartX;
-    *yoffset = newstartY;
+    *xoffset = *newstartX;
+    *yoffset = *newstartY;
   } else {
     *xoffset = 0;
     *yoffset = 0;
@@ -407,10 +397,124 @@ void placeFeature(gdImagePtr img,
   
   /* clean up */
   freeStandardLocs(standardlocs);
+  return(resize);
+} /* locateFeature */
+
+
+
+/*****************************************************************************
+ * Find space for a new feature to be added to an image at a given
+ * location. Resize the image if necessary. This requires knowing what
+ * parts of the image are "taken" by existing features. This function
+ * should be called before adding anything to an image that uses the
+ * location structs to place items.
+ *****************************************************************************/
+void placeFeature(gdImagePtr img, 
+		  char* locationAsString,
+		  BOOLEAN_T alignWithExisting, /* try to line it up with existing features */
+		  int* x,  /* where we will put the new features */
+		  int* y,
+		  USED_T* usedRegion,
+		  int featureWidth,
+		  int featureHeight,
+		  int *xoffset, int *yoffset)
+{
+  int newwidth, newheight, newstartX, newstartY;
+
+  if (locateFeature(gdImageSX(img), gdImageSY(img), locationAsString, alignWithExisting,
+		    x, y, usedRegion, featureWidth, featureHeight, xoffset, yoffset,
+		    &newwidth, &newheight, &newstartX, &newstartY)) {
+    DEBUG_CODE(1, fprintf(stderr, "Resizing\n"););
+    enlargeCanvas(img, newwidth, newheight, newstartX, newstartY);
+  }
 } /* placeFeature */
 
 
 
+/*****************************************************************************
+ * Start planning an image: an empty canvas, with nothing on it yet.
+ *****************************************************************************/
+LAYOUT_T* initLayout(void)
+{
+  LAYOUT_T* layout;
+  layout = (LAYOUT_T*)mymalloc(sizeof(LAYOUT_T));
+  layout->width = 0;
+  layout->height = 0;
+  layout->numCoords = 0;
+  return layout;
+} /* initLayout */
+
+
+
+/*****************************************************************************
+ * Keep a planned position up to date: whenever the canvas grows, x
+ * and y move along with everything else on it.
+ *****************************************************************************/
+void trackLayoutCoords(LAYOUT_T* layout, int* x, int* y)
+{
+  if (layout->numCoords >= MAXLAYOUTCOORDS) die("Too many features in the layout (at most %d)", MAXLAYOUTCOORDS);
+  layout->xCoords[layout->numCoords] = x;
+  layout->yCoords[layout->numCoords] = y;
+  layout->numCoords++;
+} /* trackLayoutCoords */
+
+
+
+/*****************************************************************************
+ * Grow the planned canvas, moving what is on it to Xplace, Yplace -
+ * the counterpart of enlargeCanvas, but only arithmetic.
+ *****************************************************************************/
+void growLayout(LAYOUT_T* layout,
+		int newXSize,
+		int newYSize,
+		int Xplace,
+		int Yplace)
+{
+  int i;
+
+  if (newXSize < layout->width || newYSize < layout->height) die("growLayout: Can't make image smaller");
+  if (Xplace + layout->width > newXSize || Yplace + layout->height > newYSize)
+    die("growLayout: New image (%d x %d) isn't going to be big enough to place old image at (%d, %d): current size is %d x %d.",
+	newXSize, newYSize, Xplace, Yplace, layout->width, layout->height);
+
+  for (i=0; i<layout->numCoords; i++) {
+    *layout->xCoords[i] += Xplace;
+    *layout->yCoords[i] += Yplace;
+  }
+  layout->width = newXSize;
+  layout->height = newYSize;
+} /* growLayout */
+
+
+
+/*****************************************************************************
+ * Plan where a feature goes, exactly as placeFeature would put it on
+ * an image of the planned size. Nothing is drawn: the canvas is only
+ * made (at its final size) once everything has been laid out. x and y
+ * are tracked from here on, so by then they are final.
+ *****************************************************************************/
+void layoutFeature(LAYOUT_T* layout,
+		   char* locationAsString,
+		   BOOLEAN_T alignWithExisting,
+		   int* x,
+		   int* y,
+		   USED_T* usedRegion,
+		   int featureWidth,
+		   int featureHeight,
+		   int *xoffset, int *yoffset)
+{
+  int newwidth, newheight, newstartX, newstartY;
+
+  if (locateFeature(layout->width, layout->height, locationAsString, alignWithExisting,
+		    x, y, usedRegion, featureWidth, featureHeight, xoffset, yoffset,
+		    &newwidth, &newheight, &newstartX, &newstartY)) {
+    growLayout(layout, newwidth, newheight, newstartX, newstartY);
+  }
+  trackLayoutCoords(layout, x, y);
+} /* layoutFeature */
+
+
+
 /*****************************************************************************
  * Resize an image canvas to make it larger. The old image is placed
  * within the new image at Xplace,Yplace (upper left). This directly
@@ -437,6 +541,10 @@ void enlargeCanvas(gdImagePtr img,
 										     newXSize, newYSize, Xplace, Yplace, gdImageSX(img), gdImageSY(img) );
   DEBUG_CODE(1, fprintf(stderr, "enlargeCanvas: Increase size from %d by %d to %d by %d, move to %d %d\n", gdImageSX(img), gdImageSY(img), newXSize, newYSize, Xplace, Yplace););
 
+  // a contiguous canvas only has to move its origin, or at worst copy each row once
+  if (growCanvas(img, newXSize, newYSize, Xplace, Yplace))
+    return;
+
   // realloc, memmove, memcopy as needed
   if (newYSize > oldYSize) {
     // add rows 
@@ -467,7 +575,7 @@ void enlargeCanvas(gdImagePtr img,
     for (i=0; i<oldYSize; i++) {
       if (Xplace != 0) {
 	memmove(&img->pixels[i][Xplace], &img->pixels[i][0], oldXSize);
-	memset(&img->pixels[i][0], 0, Xplace-1); /* set beginning to zero */
+	memset(&img->pixels[i][0], 0, Xplace); /* set beginning to zero */
       }
       if (newXSize > Xplace + oldXSize) { /* set end to zero */
 	memset(&img->pixels[i][Xplace + oldXSize], 0, newXSize - (Xplace + oldXSize));
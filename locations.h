@@ -106,8 +106,7 @@ void findLocationCoords(LOCATION_T* location,
 /*****************************************************************************
  * Adjust coordinates to align with existing features.
  *****************************************************************************/
-void align(gdImagePtr img,
-	   char* locationAsString,
+void align(char* locationAsString,
 	   int *desiredupperLeftX, 
 	   int *desiredupperLeftY, 
 	   int featureWidth, 
@@ -133,6 +132,48 @@ void placeFeature(gdImagePtr img,
 
 
 
+/*****************************************************************************
+ * An image planned before it is drawn: the size its canvas has grown
+ * to so far, and the positions (x, y pairs) of what has been placed
+ * on it, which move whenever it grows.
+ *****************************************************************************/
+#define MAXLAYOUTCOORDS 32
+typedef struct layout_t {
+  int width;
+  int height;
+  int numCoords;
+  int* xCoords[MAXLAYOUTCOORDS];
+  int* yCoords[MAXLAYOUTCOORDS];
+} LAYOUT_T;
+
+LAYOUT_T* initLayout(void);
+
+void trackLayoutCoords(LAYOUT_T* layout, int* x, int* y);
+
+void growLayout(LAYOUT_T* layout,
+		int newXSize,
+		int newYSize,
+		int Xplace,
+		int Yplace);
+
+/*****************************************************************************
+ * Plan the placement of a feature as placeFeature would make it, but
+ * on a layout rather than an image; x and y are then kept up to date
+ * as later features grow the layout.
+ *****************************************************************************/
+void layoutFeature(LAYOUT_T* layout,
+		   char* locationAsString,
+		   BOOLEAN_T alignWithExisting,
+		   int* x,
+		   int* y,
+		   USED_T* usedRegion,
+		   int featureWidth,
+		   int featureHeight,
+		   int *xoffset,
+		   int *yoffset);
+
+
+
 /*****************************************************************************
  * Resize an image canvas to make it larger. Requires making a
  * copy. The old image is placed within the new image at Xplace,Yplace
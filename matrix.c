@@ -15,6 +15,9 @@
 #include <string.h>
 #include <math.h>
 #include <float.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /**************************************************************************
  * Allocate a matrix.
@@ -903,19 +906,51 @@ void zero_mean_matrix_rows
   }
 }
 
+/* Columns are done with per-column accumulators filled one row at a
+   time, rather than by copying each (strided) column out into an
+   array, so that the matrix is only ever walked in storage order. */
 void zero_mean_matrix_cols
   (MATRIX_T* matrix)
 {
+  int num_rows = get_num_rows(matrix);
   int num_cols = get_num_cols(matrix);
+  int i_row;
   int i_col;
-  ARRAY_T* this_column;
+  ATYPE* means;
+  int* counts;
+  ATYPE* items;
+
+  means = (ATYPE*)mycalloc(num_cols, sizeof(ATYPE));
+  counts = (int*)mycalloc(num_cols, sizeof(int));
+
+  /* Accumulate the column sums, skipping missing values. */
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      if (isnan(items[i_col]))
+	continue;
+      means[i_col] += items[i_col];
+      counts[i_col]++;
+    }
+  }
 
   for (i_col = 0; i_col < num_cols; i_col++) {
-    this_column = get_matrix_column(i_col, matrix);
-    sum_to_zero(this_column);
-    set_matrix_column(this_column, i_col, matrix);
-    free_array(this_column);
+    if (counts[i_col] == 0) {
+      die("Attempting to average the elements of an empty array.\n");
+    }
+    means[i_col] /= (ATYPE)counts[i_col];
   }
+
+  /* Apply them. Missing values stay missing. */
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      items[i_col] -= means[i_col];
+    }
+  }
+
+  myfree(means);
+  myfree(counts);
 }
 
 /***********************************************************************
@@ -932,6 +967,298 @@ void variance_one_matrix_rows
   }
 }
 
+/***********************************************************************
+ * Center each row on its median and scale it by its median absolute
+ * deviation.
+ *
+ * Medians are found by selection rather than sorting, and rows are
+ * independent, so they are split among threads when OpenMP is
+ * available; each thread gets its own scratch row.
+ ***********************************************************************/
+void robust_normalize_matrix_rows
+  (MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int num_flat = 0;
+
+#pragma omp parallel reduction(+:num_flat)
+  {
+    int i_row;
+    ATYPE* scratch = (ATYPE*)mymalloc(sizeof(ATYPE) * (num_cols + 1));
+
+#pragma omp for schedule(static)
+    for (i_row = 0; i_row < num_rows; i_row++) {
+      if (!robust_scale_array(get_matrix_row(i_row, matrix), scratch)) {
+	num_flat++;
+      }
+    }
+    myfree(scratch);
+  }
+
+  if (num_flat > 0) {
+    fprintf(stderr, "Warning: %d rows had a median absolute deviation of zero and were only centered.\n", num_flat);
+  }
+}
+
+/***********************************************************************
+ * Convert each column of a matrix to z-scores (mean 0, variance 1).
+ *
+ * One pass accumulates the per-column sums and sums of squares (taken
+ * about the first non-missing value in each column, which keeps the
+ * variance from being swamped by a large mean), a second pass applies
+ * them.
+ ***********************************************************************/
+void z_score_matrix_cols
+  (MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int i_row;
+  int i_col;
+  ATYPE* shifts;
+  ATYPE* sums;
+  ATYPE* sums_sq;
+  int* counts;
+  ATYPE* items;
+  ATYPE diff;
+  ATYPE variance;
+
+  shifts = (ATYPE*)mycalloc(num_cols, sizeof(ATYPE));
+  sums = (ATYPE*)mycalloc(num_cols, sizeof(ATYPE));
+  sums_sq = (ATYPE*)mycalloc(num_cols, sizeof(ATYPE));
+  counts = (int*)mycalloc(num_cols, sizeof(int));
+
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      if (isnan(items[i_col]))
+	continue;
+      if (counts[i_col] == 0) {
+	shifts[i_col] = items[i_col];
+      }
+      diff = items[i_col] - shifts[i_col];
+      sums[i_col] += diff;
+      sums_sq[i_col] += diff * diff;
+      counts[i_col]++;
+    }
+  }
+
+  /* Turn the sums into a shift (the mean) and a scale (1/sd). */
+  for (i_col = 0; i_col < num_cols; i_col++) {
+    if (counts[i_col] == 0) {
+      die("Attempting to average the elements of an empty array.\n");
+    }
+    variance = 0.0;
+    if (counts[i_col] > 1) {
+      variance = (sums_sq[i_col] - sums[i_col] * sums[i_col] / counts[i_col])
+	/ (ATYPE)(counts[i_col] - 1);
+    }
+    shifts[i_col] += sums[i_col] / (ATYPE)counts[i_col];
+    if (variance <= 0.0) {
+      fprintf(stderr, "Warning: variance of zero.\n");
+      sums_sq[i_col] = 1.0;
+    } else {
+      sums_sq[i_col] = 1.0 / sqrt(variance);
+    }
+  }
+
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      items[i_col] = (items[i_col] - shifts[i_col]) * sums_sq[i_col];
+    }
+  }
+
+  myfree(shifts);
+  myfree(sums);
+  myfree(sums_sq);
+  myfree(counts);
+}
+
+/***********************************************************************
+ * Quantile normalization.
+ *
+ * Each column is replaced by the ranks of its values looked up in a
+ * reference distribution, which is the average of the sorted columns.
+ * Columns may have different numbers of missing values, so each sorted
+ * column is treated as a function on [0,1] (linearly interpolated
+ * between its values) and the reference is built on a grid as long as
+ * the fullest column. Tied values all get the average of the reference
+ * over their ranks. Missing values stay missing.
+ ***********************************************************************/
+typedef struct ranked_cell {
+  ATYPE value;
+  int   row;
+} RANKED_CELL_T;
+
+static int ranked_cell_compare
+  (const void* elem1,
+   const void* elem2)
+{
+  ATYPE value1 = ((RANKED_CELL_T*)elem1)->value;
+  ATYPE value2 = ((RANKED_CELL_T*)elem2)->value;
+
+  if (value1 < value2) {
+    return(-1);
+  } else if (value1 > value2) {
+    return(1);
+  }
+  return(0);
+}
+
+/* Value at fraction "where" (0 to 1) along a sorted column of length
+   num_items (> 0), interpolating between neighbours. */
+static ATYPE ranked_cells_at
+  (double         where,
+   int            num_items,
+   RANKED_CELL_T* cells)
+{
+  double position;
+  int    below;
+
+  if (num_items == 1) {
+    return(cells[0].value);
+  }
+  position = where * (double)(num_items - 1);
+  below = (int)position;
+  if (below >= num_items - 1) {
+    return(cells[num_items - 1].value);
+  }
+  return(cells[below].value
+	 + (position - below) * (cells[below + 1].value - cells[below].value));
+}
+
+/* Same thing for the reference distribution. */
+static ATYPE reference_at
+  (double where,
+   int    num_items,
+   ATYPE* reference)
+{
+  double position;
+  int    below;
+
+  if (num_items == 1) {
+    return(reference[0]);
+  }
+  position = where * (double)(num_items - 1);
+  below = (int)position;
+  if (below >= num_items - 1) {
+    return(reference[num_items - 1]);
+  }
+  return(reference[below]
+	 + (position - below) * (reference[below + 1] - reference[below]));
+}
+
+void quantile_normalize_matrix_cols
+  (MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int i_row;
+  int i_col;
+  int max_count = 0;
+  int num_used_cols = 0;
+  int* counts;
+  ATYPE* items;
+  ATYPE* reference;
+  RANKED_CELL_T* cells; /* column-major: num_rows slots per column */
+
+  if (num_rows == 0 || num_cols == 0) {
+    return;
+  }
+
+  cells = (RANKED_CELL_T*)mymalloc(sizeof(RANKED_CELL_T)
+				   * (size_t)num_rows * (size_t)num_cols);
+  counts = (int*)mycalloc(num_cols, sizeof(int));
+
+  /* Scatter the non-missing values into per-column runs, reading the
+     matrix in row order. */
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      RANKED_CELL_T* cell;
+      if (isnan(items[i_col]))
+	continue;
+      cell = &cells[(size_t)i_col * num_rows + counts[i_col]++];
+      cell->value = items[i_col];
+      cell->row = i_row;
+    }
+  }
+
+  for (i_col = 0; i_col < num_cols; i_col++) {
+    if (counts[i_col] > max_count)
+      max_count = counts[i_col];
+    if (counts[i_col] > 0)
+      num_used_cols++;
+  }
+  if (max_count == 0) {
+    myfree(cells);
+    myfree(counts);
+    return;
+  }
+
+  /* Sort the columns; they are independent. */
+#pragma omp parallel for schedule(dynamic)
+  for (i_col = 0; i_col < num_cols; i_col++) {
+    qsort(&cells[(size_t)i_col * num_rows], counts[i_col],
+	  sizeof(RANKED_CELL_T), ranked_cell_compare);
+  }
+
+  /* The reference distribution: the mean of the columns at each point
+     of the grid. */
+  reference = (ATYPE*)mymalloc(sizeof(ATYPE) * max_count);
+#pragma omp parallel for schedule(static)
+  for (i_row = 0; i_row < max_count; i_row++) {
+    double where = (max_count == 1) ? 0.0
+      : (double)i_row / (double)(max_count - 1);
+    ATYPE total = 0.0;
+    int j_col;
+
+    for (j_col = 0; j_col < num_cols; j_col++) {
+      if (counts[j_col] == 0)
+	continue;
+      total += ranked_cells_at(where, counts[j_col],
+			       &cells[(size_t)j_col * num_rows]);
+    }
+    reference[i_row] = total / (ATYPE)num_used_cols;
+  }
+
+  /* Write the reference values back in place of the originals. */
+#pragma omp parallel for schedule(dynamic)
+  for (i_col = 0; i_col < num_cols; i_col++) {
+    RANKED_CELL_T* column = &cells[(size_t)i_col * num_rows];
+    int count = counts[i_col];
+    int start;
+    int end;
+    int i_rank;
+    ATYPE total;
+
+    for (start = 0; start < count; start = end) {
+      /* Find the run of ties starting here. */
+      end = start + 1;
+      while (end < count && column[end].value == column[start].value)
+	end++;
+
+      total = 0.0;
+      for (i_rank = start; i_rank < end; i_rank++) {
+	total += reference_at((count == 1) ? 0.0
+			      : (double)i_rank / (double)(count - 1),
+			      max_count, reference);
+      }
+      total /= (ATYPE)(end - start);
+
+      for (i_rank = start; i_rank < end; i_rank++) {
+	set_matrix_cell(column[i_rank].row, i_col, total, matrix);
+      }
+    }
+  }
+
+  myfree(reference);
+  myfree(cells);
+  myfree(counts);
+}
+
 /***********************************************************************
  * Iteratively normalize the rows and columns in a matrix.
  ***********************************************************************/
@@ -1017,6 +1344,413 @@ void normalize_matrix
   myfree(one_column);
 }
 
+/***********************************************************************
+ * Shrink a matrix by combining blocks of neighboring cells.
+ *
+ * Row bin b covers rows [row_start[b], row_start[b+1]); col_bin gives
+ * the bin of each column. Each output row reads its input rows once,
+ * in order, folding them into per-column-bin accumulators; output rows
+ * are shared among threads.
+ ***********************************************************************/
+static MATRIX_T* combine_blocks
+  (int       num_row_bins,
+   int*      row_start,
+   int       num_col_bins,
+   int*      col_bin,
+   binmode_T mode,
+   MATRIX_T* matrix)
+{
+  int num_cols = get_num_cols(matrix);
+  int i_bin;
+  MATRIX_T* result;
+
+  result = allocate_matrix(num_row_bins, num_col_bins);
+
+#pragma omp parallel
+  {
+    double* acc = (double*)mymalloc(sizeof(double) * num_col_bins);
+    int* counts = (int*)mymalloc(sizeof(int) * num_col_bins);
+    int j_bin;
+
+#pragma omp for schedule(dynamic, 8)
+    for (i_bin = 0; i_bin < num_row_bins; i_bin++) {
+      MTYPE* out = raw_array(get_matrix_row(i_bin, result));
+      int i_row, j_col;
+
+      memset(acc, 0, sizeof(double) * num_col_bins);
+      memset(counts, 0, sizeof(int) * num_col_bins);
+      for (i_row = row_start[i_bin]; i_row < row_start[i_bin + 1]; i_row++) {
+	MTYPE* items = raw_array(get_matrix_row(i_row, matrix));
+	for (j_col = 0; j_col < num_cols; j_col++) {
+	  double value = items[j_col];
+	  int b = col_bin[j_col];
+
+	  if (isnan(value)) {
+	    continue;
+	  }
+	  if (mode == mean_bins || counts[b] == 0) {
+	    acc[b] = (mode == mean_bins) ? acc[b] + value : value;
+	  } else if (mode == maxabs_bins) {
+	    if (fabs(value) > fabs(acc[b])) acc[b] = value;
+	  } else if (mode == max_bins) {
+	    if (value > acc[b]) acc[b] = value;
+	  } else if (value < acc[b]) {
+	    acc[b] = value;
+	  }
+	  counts[b]++;
+	}
+      }
+      for (j_bin = 0; j_bin < num_col_bins; j_bin++) {
+	if (counts[j_bin] == 0) {
+	  out[j_bin] = NaN();
+	} else if (mode == mean_bins) {
+	  out[j_bin] = acc[j_bin] / counts[j_bin];
+	} else {
+	  out[j_bin] = acc[j_bin];
+	}
+      }
+    }
+    myfree(acc);
+    myfree(counts);
+  }
+  return(result);
+}
+
+/***********************************************************************
+ * Bin to a given size: row bin b covers rows
+ * [b*num_rows/num_row_bins, (b+1)*...), and the same for columns, so
+ * bins differ in size by at most one.
+ ***********************************************************************/
+MATRIX_T* bin_matrix
+  (int       num_row_bins,
+   int       num_col_bins,
+   binmode_T mode,
+   MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int* row_start;
+  int* col_bin;
+  int i_bin;
+  int i_col;
+  MATRIX_T* result;
+
+  myassert(1, num_row_bins > 0 && num_row_bins <= num_rows
+	   && num_col_bins > 0 && num_col_bins <= num_cols,
+	   "Can't bin %d by %d values into %d by %d.\n",
+	   num_rows, num_cols, num_row_bins, num_col_bins);
+
+  row_start = (int*)mymalloc(sizeof(int) * (num_row_bins + 1));
+  for (i_bin = 0; i_bin <= num_row_bins; i_bin++) {
+    row_start[i_bin] = (int)((long)i_bin * num_rows / num_row_bins);
+  }
+  col_bin = (int*)mymalloc(sizeof(int) * num_cols);
+  for (i_bin = 0; i_bin < num_col_bins; i_bin++) {
+    int start = (int)((long)i_bin * num_cols / num_col_bins);
+    int end = (int)((long)(i_bin + 1) * num_cols / num_col_bins);
+    for (i_col = start; i_col < end; i_col++) {
+      col_bin[i_col] = i_bin;
+    }
+  }
+
+  result = combine_blocks(num_row_bins, row_start, num_col_bins, col_bin, mode, matrix);
+  myfree(row_start);
+  myfree(col_bin);
+  return(result);
+}
+
+/***********************************************************************
+ * Halve a matrix in each direction, combining 2x2 blocks (smaller
+ * ones at an odd edge), so that cell (i, j) of the result covers
+ * exactly cells 2i..2i+1, 2j..2j+1 of the original.
+ ***********************************************************************/
+MATRIX_T* halve_matrix
+  (binmode_T mode,
+   MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int num_row_bins = (num_rows + 1) / 2;
+  int* row_start;
+  int* col_bin;
+  int i;
+  MATRIX_T* result;
+
+  row_start = (int*)mymalloc(sizeof(int) * (num_row_bins + 1));
+  for (i = 0; i < num_row_bins; i++) {
+    row_start[i] = 2 * i;
+  }
+  row_start[num_row_bins] = num_rows;
+  col_bin = (int*)mymalloc(sizeof(int) * (num_cols + 1));
+  for (i = 0; i < num_cols; i++) {
+    col_bin[i] = i / 2;
+  }
+
+  result = combine_blocks(num_row_bins, row_start, (num_cols + 1) / 2, col_bin, mode, matrix);
+  myfree(row_start);
+  myfree(col_bin);
+  return(result);
+}
+
+/***********************************************************************
+ * Copy the top left num_rows x num_cols corner of a matrix.
+ ***********************************************************************/
+MATRIX_T* crop_matrix
+  (int       num_rows,
+   int       num_cols,
+   MATRIX_T* matrix)
+{
+  int i_row;
+  MATRIX_T* result;
+
+  myassert(1, num_rows > 0 && num_rows <= get_num_rows(matrix)
+	   && num_cols > 0 && num_cols <= get_num_cols(matrix),
+	   "Can't crop %d by %d values to %d by %d.\n",
+	   get_num_rows(matrix), get_num_cols(matrix), num_rows, num_cols);
+
+  result = allocate_matrix(num_rows, num_cols);
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    memcpy(raw_array(get_matrix_row(i_row, result)),
+	   raw_array(get_matrix_row(i_row, matrix)), sizeof(MTYPE) * num_cols);
+  }
+  return(result);
+}
+
+/***********************************************************************
+ * Transpose a matrix into a new one.
+ *
+ * The copy goes a square tile at a time so that both the rows being
+ * read and the rows being written stay in cache; a naive copy walks
+ * down the columns of one or the other. Each thread takes whole bands
+ * of output rows.
+ ***********************************************************************/
+#define TRANSPOSE_BLOCK 32
+
+MATRIX_T* transpose_matrix
+  (MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int num_bands = (num_cols + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+  int i_band;
+  MATRIX_T* result;
+
+  result = allocate_matrix(num_cols, num_rows);
+
+#pragma omp parallel for schedule(static)
+  for (i_band = 0; i_band < num_bands; i_band++) {
+    int col_start = i_band * TRANSPOSE_BLOCK;
+    int col_end = (col_start + TRANSPOSE_BLOCK < num_cols) ? col_start + TRANSPOSE_BLOCK : num_cols;
+    int row_start;
+
+    for (row_start = 0; row_start < num_rows; row_start += TRANSPOSE_BLOCK) {
+      int row_end = (row_start + TRANSPOSE_BLOCK < num_rows) ? row_start + TRANSPOSE_BLOCK : num_rows;
+      int i_row, i_col;
+
+      for (i_row = row_start; i_row < row_end; i_row++) {
+	MTYPE* items = raw_array(get_matrix_row(i_row, matrix));
+	for (i_col = col_start; i_col < col_end; i_col++) {
+	  raw_array(get_matrix_row(i_col, result))[i_row] = items[i_col];
+	}
+      }
+    }
+  }
+  return(result);
+}
+
+/***********************************************************************
+ * Copy the rows (or columns) of a matrix into one contiguous block,
+ * one variable after another, optionally centering and scaling each.
+ ***********************************************************************/
+MTYPE* get_matrix_variables
+  (BOOLEAN_T  by_cols,
+   BOOLEAN_T  standardize,
+   BOOLEAN_T* flat,
+   MATRIX_T*  matrix)
+{
+  int num_vars;
+  int num_obs;
+  int i_var;
+  int i_obs;
+  MTYPE* values;
+
+  if (by_cols) {
+    num_vars = get_num_cols(matrix);
+    num_obs = get_num_rows(matrix);
+  } else {
+    num_vars = get_num_rows(matrix);
+    num_obs = get_num_cols(matrix);
+  }
+
+  values = (MTYPE*)mymalloc(sizeof(MTYPE) * ((size_t)num_vars * num_obs + 1));
+
+  /* For columns this is a transpose, done reading the matrix in row
+     order. */
+  for (i_obs = 0; i_obs < (by_cols ? num_obs : num_vars); i_obs++) {
+    MTYPE* items = raw_array(get_matrix_row(i_obs, matrix));
+    if (by_cols) {
+      for (i_var = 0; i_var < num_vars; i_var++) {
+	values[(size_t)i_var * num_obs + i_obs] = items[i_var];
+      }
+    } else {
+      memcpy(&values[(size_t)i_obs * num_obs], items, sizeof(MTYPE) * num_obs);
+    }
+  }
+
+  if (!standardize) {
+    return(values);
+  }
+
+#pragma omp parallel for schedule(static)
+  for (i_var = 0; i_var < num_vars; i_var++) {
+    MTYPE* var = &values[(size_t)i_var * num_obs];
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    double mean;
+    int count = 0;
+    int j_obs;
+
+    for (j_obs = 0; j_obs < num_obs; j_obs++) {
+      if (!isnan(var[j_obs])) {
+	sum += var[j_obs];
+	count++;
+      }
+    }
+    mean = (count > 0) ? sum / count : 0.0;
+    for (j_obs = 0; j_obs < num_obs; j_obs++) {
+      if (isnan(var[j_obs])) {
+	var[j_obs] = 0.0;
+      } else {
+	var[j_obs] -= mean;
+	sum_sq += var[j_obs] * var[j_obs];
+      }
+    }
+    if (flat != NULL) {
+      flat[i_var] = (sum_sq <= 0.0);
+    }
+    if (sum_sq <= 0.0) {
+      continue;
+    }
+    sum_sq = 1.0 / sqrt(sum_sq);
+    for (j_obs = 0; j_obs < num_obs; j_obs++) {
+      var[j_obs] *= sum_sq;
+    }
+  }
+  return(values);
+}
+
+/***********************************************************************
+ * Correlation matrix of the rows (or columns) of a matrix.
+ *
+ * Each row is centered and scaled once so that its sum of squares is
+ * one, with missing values then set to zero (i.e. to the row mean);
+ * the correlations are then the dot products of the scaled rows,
+ * computed as a matrix product over cache-sized tiles. Only tiles on
+ * or above the diagonal are computed, split among threads by block
+ * row, and the lower triangle is filled in by mirroring.
+ *
+ * Rows with no variance have no defined correlation: their row and
+ * column of the result are missing.
+ ***********************************************************************/
+#define CORR_BLOCK 64   /* rows (and result columns) per tile */
+#define CORR_DEPTH 256  /* values per row taken at a time within a tile */
+
+MATRIX_T* correlation_matrix
+  (BOOLEAN_T by_cols,
+   MATRIX_T* matrix)
+{
+  int num_vars;   /* what is being correlated */
+  int num_obs;    /* values per variable */
+  int num_blocks;
+  int i_var;
+  int i_block;
+  MTYPE* scaled;  /* num_vars x num_obs, contiguous */
+  BOOLEAN_T* flat;
+  MATRIX_T* result;
+
+  if (by_cols) {
+    num_vars = get_num_cols(matrix);
+    num_obs = get_num_rows(matrix);
+  } else {
+    num_vars = get_num_rows(matrix);
+    num_obs = get_num_cols(matrix);
+  }
+
+  flat = (BOOLEAN_T*)mycalloc(num_vars + 1, sizeof(BOOLEAN_T));
+  result = allocate_matrix(num_vars, num_vars);
+
+  /* One variable per contiguous row, centered and scaled. */
+  scaled = get_matrix_variables(by_cols, TRUE, flat, matrix);
+
+  /* The product, tile by tile. Each thread owns whole block rows of
+     the result, so no two threads write the same row. */
+  num_blocks = (num_vars + CORR_BLOCK - 1) / CORR_BLOCK;
+#pragma omp parallel for schedule(dynamic)
+  for (i_block = 0; i_block < num_blocks; i_block++) {
+    int i_start = i_block * CORR_BLOCK;
+    int i_end = (i_start + CORR_BLOCK < num_vars) ? i_start + CORR_BLOCK : num_vars;
+    int j_block;
+
+    for (j_block = i_block; j_block < num_blocks; j_block++) {
+      int j_start = j_block * CORR_BLOCK;
+      int j_end = (j_start + CORR_BLOCK < num_vars) ? j_start + CORR_BLOCK : num_vars;
+      int k_start;
+
+      for (k_start = 0; k_start < num_obs; k_start += CORR_DEPTH) {
+	int k_end = (k_start + CORR_DEPTH < num_obs) ? k_start + CORR_DEPTH : num_obs;
+	int i, j, k;
+
+	for (i = i_start; i < i_end; i++) {
+	  MTYPE* row_i = &scaled[(size_t)i * num_obs];
+	  MTYPE* out = raw_array(get_matrix_row(i, result));
+	  for (j = (j_start > i ? j_start : i); j < j_end; j++) {
+	    MTYPE* row_j = &scaled[(size_t)j * num_obs];
+	    double dot = 0.0;
+	    for (k = k_start; k < k_end; k++) {
+	      dot += row_i[k] * row_j[k];
+	    }
+	    out[j] += dot;
+	  }
+	}
+      }
+    }
+  }
+
+  /* Mirror into the lower triangle (reading only the upper one), then
+     tidy up: clip rounding error and blank out undefined values. */
+#pragma omp parallel for schedule(static)
+  for (i_var = 0; i_var < num_vars; i_var++) {
+    MTYPE* out = raw_array(get_matrix_row(i_var, result));
+    int j_var;
+
+    for (j_var = 0; j_var < i_var; j_var++) {
+      out[j_var] = get_matrix_cell(j_var, i_var, result);
+    }
+  }
+#pragma omp parallel for schedule(static)
+  for (i_var = 0; i_var < num_vars; i_var++) {
+    MTYPE* out = raw_array(get_matrix_row(i_var, result));
+    int j_var;
+
+    for (j_var = 0; j_var < num_vars; j_var++) {
+      if (flat[i_var] || flat[j_var]) {
+	out[j_var] = NaN();
+      } else if (out[j_var] > 1.0) { /* rounding */
+	out[j_var] = 1.0;
+      } else if (out[j_var] < -1.0) {
+	out[j_var] = -1.0;
+      }
+    }
+    if (!flat[i_var]) {
+      out[i_var] = 1.0;
+    }
+  }
+
+  myfree(scaled);
+  myfree(flat);
+  return(result);
+}
+
 /*****************************************************************************
  * Extract one margin of a matrix and return it as an array.
  *****************************************************************************/
@@ -1044,25 +1778,95 @@ ARRAY_T* get_matrix_row_sums
 ARRAY_T* get_matrix_col_sums
   (MATRIX_T* matrix)
 {
+  int      num_rows;
   int      num_cols;
+  int      i_row;
   int      i_col;
-  ARRAY_T* this_column;
+  ATYPE*   items;
+  ATYPE*   sums;
   ARRAY_T* matrix_sums;
 
   /* Allocate the margin array. */
+  num_rows = get_num_rows(matrix);
   num_cols = get_num_cols(matrix);
   matrix_sums = allocate_array(num_cols);
+  sums = raw_array(matrix_sums);
 
-  /* Get the sums. */
-  for (i_col = 0; i_col < num_cols; i_col++) {
-    this_column = get_matrix_column(i_col, matrix);
-    set_array_item(i_col, array_total(this_column), matrix_sums);
-    free_array(this_column);
+  /* Get the sums, a row at a time. */
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      if (isnan(items[i_col]))
+	continue;
+      sums[i_col] += items[i_col];
+    }
   }
 
   return(matrix_sums);
 }
 
+/*****************************************************************************
+ * A sort key for every row: its mean, variance or largest value
+ * (over the values present), or its value in one column. Rows with no
+ * values get a missing key.
+ *****************************************************************************/
+ARRAY_T* get_matrix_row_keys
+  (rowkey_T  which,
+   int       col,
+   MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  ARRAY_T* keys = allocate_array(num_rows);
+  MTYPE* key_items = raw_array(keys);
+  int i_row;
+
+  if (which == column_key && (col < 0 || col >= num_cols)) {
+    die("No column %d to sort by.\n", col + 1);
+  }
+
+#pragma omp parallel for schedule(static)
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    MTYPE* items = raw_array(get_matrix_row(i_row, matrix));
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    double first = 0.0;
+    double key = NaN();
+    int count = 0;
+    int i_col;
+
+    if (which == column_key) {
+      key_items[i_row] = items[col];
+      continue;
+    }
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      double value = items[i_col];
+      if (isnan(value)) {
+	continue;
+      }
+      if (count == 0) {
+	first = value;
+	key = value;
+      }
+      if (which == max_key) {
+	if (value > key) key = value;
+      } else {
+	/* shifted by the first value, for a stable variance */
+	sum += value - first;
+	sum_sq += (value - first) * (value - first);
+      }
+      count++;
+    }
+    if (count > 0 && which == mean_key) {
+      key = first + sum / count;
+    } else if (which == variance_key) {
+      key = (count > 1) ? (sum_sq - sum * sum / count) / (count - 1) : NaN();
+    }
+    key_items[i_row] = key;
+  }
+  return(keys);
+}
+
 /*****************************************************************************
  * Sort a given matrix by row or column, according to a given set of
  * sort keys.
@@ -1133,6 +1937,57 @@ void sort_matrix_rows
 }
 
 
+/*****************************************************************************
+ * Reorder the rows of a matrix so that row i becomes the old row
+ * order[i]. Only the row pointers move.
+ *****************************************************************************/
+void permute_matrix_rows
+  (int*      order,
+   MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  ARRAY_T** new_rows;
+  int i_row;
+
+  new_rows = (ARRAY_T**)mymalloc(sizeof(ARRAY_T*) * num_rows);
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    myassert(1, order[i_row] >= 0 && order[i_row] < num_rows,
+	     "Bad row %d in matrix permutation.\n", order[i_row]);
+    new_rows[i_row] = matrix->rows[order[i_row]];
+  }
+  myfree(matrix->rows);
+  matrix->rows = new_rows;
+}
+
+/*****************************************************************************
+ * Reorder the columns of a matrix so that column j becomes the old
+ * column order[j].
+ *****************************************************************************/
+void permute_matrix_cols
+  (int*      order,
+   MATRIX_T* matrix)
+{
+  int num_rows = get_num_rows(matrix);
+  int num_cols = get_num_cols(matrix);
+  int i_row;
+
+#pragma omp parallel
+  {
+    MTYPE* scratch = (MTYPE*)mymalloc(sizeof(MTYPE) * (num_cols + 1));
+    int i;
+
+#pragma omp for schedule(static)
+    for (i_row = 0; i_row < num_rows; i_row++) {
+      MTYPE* items = raw_array(get_matrix_row(i_row, matrix));
+      for (i = 0; i < num_cols; i++) {
+	scratch[i] = items[order[i]];
+      }
+      memcpy(items, scratch, sizeof(MTYPE) * num_cols);
+    }
+    myfree(scratch);
+  }
+}
+
 /* Find the minimum value in a matrix */
 MTYPE find_matrix_min (MATRIX_T* matrix)
 {
@@ -1214,74 +2069,6 @@ void find_matrix_min_and_max (MATRIX_T* matrix, MTYPE* min, MTYPE* max,
 }
 
 
-
-/* find both the max and min of a matrix, and their locations in the
-   matrix. (ties are not given special treatment) */
-int simple_compare (const void* elem1, const void* elem2)
-{
-  MTYPE value1 = *((MTYPE*)elem1);
-  MTYPE value2 = *((MTYPE*)elem2);
-  if (value1 > value2) {
-    return(1);
-  } else if (value1 < value2) {
-    return(-1);
-  }
-  return(0);
-}
-
-void find_rawmatrix_min_and_max (MTYPE** matrix, int num_rows, int num_cols, double outliers, MTYPE* min, MTYPE* max) 
-{
-  int i,j,d;
-  MTYPE lmin = (MTYPE)(FLT_MAX);
-  MTYPE lmax = -(MTYPE)(FLT_MAX);
-  MTYPE value = 0.0;
-
-
-  myassert(TRUE, outliers >= 0.0 && outliers <= 50.0, "Invalid outliers value %f", outliers);
-
-  d = 0;
-  if (outliers) {
-    int index_dist;
-    MTYPE* concatenated_data = (MTYPE*)mymalloc(sizeof(MTYPE)*num_rows*num_cols);
-    for (i=0; i<num_rows; i++) {
-      for(j=0; j< num_cols;j++) {
-	if (isnan(matrix[i][j])) { // don't include NaN in computation of range.
-	  continue;
-	}
-	concatenated_data[d] = matrix[i][j];
-	d++;
-      }
-    }
-    myassert(TRUE, d > 0, "No data found!!");
-    qsort(concatenated_data, d, sizeof(MTYPE), simple_compare);
-
-    index_dist = (int)ceil(((double)d * outliers/100.0));
-    lmin = concatenated_data[index_dist];
-    lmax = concatenated_data[d - index_dist - 1];
-    if(verbosity > NORMAL_VERBOSE)
-      fprintf(stderr, "Minimum value is %.2f; maximum value is %.2f; trimming outliers below %.2f and above %.2f\n", concatenated_data[0], concatenated_data[d -1], lmin, lmax);
-    free(concatenated_data);
-  } else {
-    for (i=0; i<num_rows; i++) {
-      for(j=0; j<num_cols; j++) {
-	value = matrix[i][j];
-	if (value < lmin) {
-	  lmin = value;
-	} 
-	if (value > lmax) {
-	  lmax = value;
-	}
-      }
-    }
-    if (verbosity > NORMAL_VERBOSE)
-      fprintf(stderr, "Minimum value is %.2f; maximum values is %.2f\n", lmin, lmax);
-  }
-
-  *min = lmin;
-  *max = lmax;
-}
-
-
 /*
  * Local Variables:
  * mode: c
@@ -327,6 +327,85 @@ void zero_mean_matrix_cols
 void variance_one_matrix_rows
   (MATRIX_T* matrix);
 
+/***********************************************************************
+ * Center each row on its median and scale by its median absolute
+ * deviation (robust alternative to the mean/variance normalization).
+ ***********************************************************************/
+void robust_normalize_matrix_rows
+  (MATRIX_T* matrix);
+
+/***********************************************************************
+ * Convert each column of a matrix to mean 0 and variance 1.
+ ***********************************************************************/
+void z_score_matrix_cols
+  (MATRIX_T* matrix);
+
+/***********************************************************************
+ * Quantile-normalize the columns of a matrix, in place: every column
+ * ends up with the same distribution of values (the average of the
+ * sorted columns). Missing values are ignored and left missing.
+ ***********************************************************************/
+void quantile_normalize_matrix_cols
+  (MATRIX_T* matrix);
+
+/***********************************************************************
+ * Return a num_row_bins x num_col_bins matrix, each cell combining a
+ * block of neighboring cells of the given one: their mean, the value
+ * largest in magnitude, the largest or the smallest. Missing values
+ * are ignored; a block with none present gives a missing value.
+ ***********************************************************************/
+typedef enum {mean_bins, maxabs_bins, max_bins, min_bins} binmode_T;
+
+MATRIX_T* bin_matrix
+  (int       num_row_bins,
+   int       num_col_bins,
+   binmode_T mode,
+   MATRIX_T* matrix);
+
+/***********************************************************************
+ * Combine 2x2 blocks as above, giving a matrix of half the size
+ * (rounded up) in each direction.
+ ***********************************************************************/
+MATRIX_T* halve_matrix
+  (binmode_T mode,
+   MATRIX_T* matrix);
+
+/***********************************************************************
+ * Return a new matrix of the first num_rows rows and num_cols columns
+ * of the given one.
+ ***********************************************************************/
+MATRIX_T* crop_matrix
+  (int       num_rows,
+   int       num_cols,
+   MATRIX_T* matrix);
+
+/***********************************************************************
+ * Return a new matrix that is the transpose of the given one.
+ ***********************************************************************/
+MATRIX_T* transpose_matrix
+  (MATRIX_T* matrix);
+
+/***********************************************************************
+ * Copy the rows (or columns) of a matrix into a contiguous block of
+ * num_vars x num_obs values, one variable per row. With standardize,
+ * each variable is centered and scaled to unit sum of squares and
+ * its missing values set to zero (the mean); flat[i] (if not NULL)
+ * is set for variables with no variance. Caller frees.
+ ***********************************************************************/
+MTYPE* get_matrix_variables
+  (BOOLEAN_T  by_cols,
+   BOOLEAN_T  standardize,
+   BOOLEAN_T* flat,
+   MATRIX_T*  matrix);
+
+/***********************************************************************
+ * Correlation (Pearson) matrix of the rows, or of the columns, of a
+ * matrix. Missing values are treated as equal to the mean.
+ ***********************************************************************/
+MATRIX_T* correlation_matrix
+  (BOOLEAN_T by_cols,
+   MATRIX_T* matrix);
+
 /***********************************************************************
  * Multiply two matrices to get a third.
  ***********************************************************************/
@@ -362,6 +441,17 @@ ARRAY_T* get_matrix_row_sums
 ARRAY_T* get_matrix_col_sums
   (MATRIX_T* matrix);
 
+/*****************************************************************************
+ * Compute a sort key for each row of a matrix: the mean, variance or
+ * maximum of its values, or the value in column col.
+ *****************************************************************************/
+typedef enum {mean_key, variance_key, max_key, column_key} rowkey_T;
+
+ARRAY_T* get_matrix_row_keys
+  (rowkey_T  which,
+   int       col,
+   MATRIX_T* matrix);
+
 /*****************************************************************************
  * Sort a given matrix by row, according to a given set of sort keys.
  *****************************************************************************/
@@ -371,6 +461,17 @@ void sort_matrix_rows
    MATRIX_T* matrix);
 
 
+/*****************************************************************************
+ * Reorder the rows (or columns) of a matrix in place so that row
+ * (column) i becomes the old row (column) order[i].
+ *****************************************************************************/
+void permute_matrix_rows
+  (int*      order,
+   MATRIX_T* matrix);
+void permute_matrix_cols
+  (int*      order,
+   MATRIX_T* matrix);
+
 /* Find the minimum value in a matrix */
 MTYPE find_matrix_min (MATRIX_T* matrix);
 
@@ -383,8 +484,6 @@ void find_matrix_min_and_max (MATRIX_T* matrix, MTYPE* min, MTYPE* max,
 			      int* maxrow, int* maxcol, int* minrow, int* mincol);
 
 
-void find_rawmatrix_min_and_max (MTYPE** matrix, int num_rows, int num_cols, double outliers, MTYPE* min, MTYPE* max);
-
 #endif
 
 /*
@@ -9,6 +9,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "matrix2png.h"
 #include "gd.h"
 #include "locations.h"
@@ -25,6 +27,12 @@
 #include "cmdparse.h"
 #include "addextras.h"
 #include "matrixinfo.h"
+#include "cluster.h"
+#include "tiles.h"
+#include "canvas.h"
+#include "hash.h"
+#include "ttfont.h"
+#include "pngstream.h"
 #include <float.h>
 
 
@@ -34,6 +42,12 @@ MATRIXINFO_T* newMatrixInfo(void) {
   return_value = (MATRIXINFO_T*)mymalloc(sizeof(MATRIXINFO_T));
   return_value->discreteMap = NULL;
   return_value->numColors = DEFAULTNUMCOLORS;
+  return_value->stats = NULL;
+  return_value->scaleHistogram = FALSE;
+  return_value->layout = NULL;
+  return_value->thinLabels = FALSE;
+  return_value->rowLabelCandidates = NULL;
+  return_value->colLabelCandidates = NULL;
   return(return_value);
 } /* newMatrixInfo */
 
@@ -88,6 +102,427 @@ gdImagePtr matrix2img (
 
 
 
+/* Allocate the palette for a matrix image: from a preset map, a
+   discrete map, or graded between the user's colors. */
+void allocateImageColors (
+		     gdImagePtr img,
+		     colorV_T* backgroundColor,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* missingColor,
+		     BOOLEAN_T passThroughBlack,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  if (colorMap) {
+    allocateColorMap(img, backgroundColor, missingColor, colorMap, matrixInfo);
+  } else if (matrixInfo->discreteMap != NULL) {
+    allocateColorsDiscrete(img, matrixInfo->discreteMap, backgroundColor, missingColor);
+  } else {
+    allocateColors(img, backgroundColor, minColor, midColor, maxColor, missingColor, passThroughBlack, matrixInfo->numColors);
+  }
+} /* allocateImageColors */
+
+
+
+/* The palette index for one value, given the range mapped onto the
+   colors. numColorsTotal is the size of the palette. */
+int valueColorCode (
+		     double value,
+		     double min,
+		     double max,
+		     double stepsize,
+		     BOOLEAN_T clip, /* clamp values outside min..max */
+		     int numColorsTotal,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  int colorcode;
+
+  if (isnan(value)) { // missing value
+    colorcode = MISSING;
+  } else if (matrixInfo->discreteMap != NULL) { // discrete map
+    // values are coerced to ints to look them up in the map.
+    value = (double)discreteMapIndex((int)value, matrixInfo->discreteMap);
+    DEBUG_CODE(1, fprintf(stderr, "Discrete map entry %d\n", (int)value););
+    if (value > matrixInfo->discreteMap->count || value < 0) {
+      colorcode = DEFAULT_DISCRETE_COLOR_INDEX;
+    } else {
+      colorcode = (int)value + NUMRESERVEDCOLORS + 1;
+      DEBUG_CODE(1, fprintf(stderr, "Colorcode %d for value %d\n", (int)colorcode, (int)value););
+    }
+  } else { // normal
+    /* clip color if necessary */
+    if (clip) {
+      if (value > max) {
+	value = max;
+      } else if (value < min) {
+	value = min;
+      }
+    }
+    colorcode = (int)(( (value - min) / stepsize) + NUMRESERVEDCOLORS);
+    if (colorcode > numColorsTotal - 1)
+      colorcode = numColorsTotal - 1;
+  }
+  return colorcode;
+} /* valueColorCode */
+
+
+
+/* Map a row of values to palette indices, as valueColorCode would
+   one at a time. The continuous mapping is done with clamps and
+   selects only, so the loop has no branches and can be vectorized;
+   discrete maps cost a table lookup per value. */
+void mapValuesToColors (
+		     MTYPE* values,
+		     int numValues,
+		     double min,
+		     double max,
+		     double stepsize,
+		     BOOLEAN_T clip,
+		     int numColorsTotal,
+		     MATRIXINFO_T* matrixInfo,
+		     unsigned char* codes
+		     )
+{
+  int j;
+  double low = clip ? min : -DBL_MAX;
+  double high = clip ? max : DBL_MAX;
+  double lowestCode = NUMRESERVEDCOLORS;
+  double highestCode = numColorsTotal - 1;
+
+  if (matrixInfo->discreteMap != NULL) {
+    DISCRETEMAP_T* dmap = matrixInfo->discreteMap;
+    int k;
+    for (j = 0; j < numValues; j++) {
+      if (isnan(values[j])) {
+	codes[j] = MISSING;
+	continue;
+      }
+      k = discreteMapIndex((int)values[j], dmap);
+      codes[j] = (unsigned char)(k < 0 ? DEFAULT_DISCRETE_COLOR_INDEX : k + NUMRESERVEDCOLORS + 1);
+    }
+    return;
+  }
+
+  for (j = 0; j < numValues; j++) {
+    double value = values[j];
+    double code;
+
+    value = value > high ? high : value;
+    value = value < low ? low : value;
+    code = (value - min) / stepsize + NUMRESERVEDCOLORS;
+    code = code > highestCode ? highestCode : code;
+    code = code < lowestCode ? lowestCode : code;
+    code = (value == value) ? code : MISSING; /* NaN is missing */
+    codes[j] = (unsigned char)(int)code;
+  }
+} /* mapValuesToColors */
+
+
+
+/* The pixels of a width x height cell that lie within the ellipse
+   inscribed in it (pixel centers on or inside the edge), as one span
+   per pixel row: row r is covered from start[r] up to but not
+   including end[r]. Every cell is drawn from these, so all cells get
+   exactly the same shape. */
+static void ellipseSpans (
+		     int width,
+		     int height,
+		     int* start,
+		     int* end
+		     )
+{
+  int r;
+  double xRad = width / 2.0;
+  double yRad = height / 2.0;
+
+  for (r = 0; r < height; r++) {
+    double dy = (r + 0.5 - yRad) / yRad;
+    double halfWidth;
+    if (dy * dy > 1.0) {
+      start[r] = end[r] = 0;
+      continue;
+    }
+    halfWidth = xRad * sqrt(1.0 - dy * dy);
+    start[r] = (int)ceil(xRad - halfWidth - 0.5);
+    end[r] = (int)floor(xRad + halfWidth - 0.5) + 1;
+    if (start[r] < 0) start[r] = 0;
+    if (end[r] > width) end[r] = width;
+  }
+} /* ellipseSpans */
+
+
+
+/* Row kernels for drawing the matrix: each lays out one pixel row
+   of a matrix row's cells, given their palette indices, into
+   scanline. There is one for each kind of cell - a single pixel,
+   a rectangle or an ellipse (the row's span of it, background either
+   side), with or without a divider pixel after it - so the choice is
+   made once per image and the loops themselves don't branch. */
+typedef void (*CELLROW_KERNEL_T)(unsigned char* codes, int numCols,
+				 int xSize, int runWidth,
+				 unsigned char dividerColor,
+				 int spanStart, int spanEnd,
+				 unsigned char* scanline);
+
+#define CELLROW_KERNEL(name, UNIT, DIVIDERS, ELLIPSE)			\
+static void name (unsigned char* codes, int numCols,			\
+		  int xSize, int runWidth,				\
+		  unsigned char dividerColor,				\
+		  int spanStart, int spanEnd,				\
+		  unsigned char* scanline)				\
+{									\
+  int j;								\
+  int step = UNIT ? 1 + DIVIDERS : xSize;				\
+  for (j = 0; j < numCols; j++, scanline += step) {			\
+    if (UNIT) {								\
+      scanline[0] = codes[j];						\
+    } else if (ELLIPSE) {						\
+      memset(scanline, 0, spanStart);					\
+      memset(scanline + spanStart, codes[j], spanEnd - spanStart);	\
+      memset(scanline + spanEnd, 0, runWidth - spanEnd);		\
+    } else {								\
+      memset(scanline, codes[j], runWidth);				\
+    }									\
+    if (DIVIDERS)							\
+      scanline[UNIT ? 1 : runWidth] = dividerColor;			\
+  }									\
+}
+
+CELLROW_KERNEL(cellRowUnit, 1, 0, 0)
+CELLROW_KERNEL(cellRowUnitDividers, 1, 1, 0)
+CELLROW_KERNEL(cellRowRect, 0, 0, 0)
+CELLROW_KERNEL(cellRowRectDividers, 0, 1, 0)
+CELLROW_KERNEL(cellRowEllipse, 0, 0, 1)
+CELLROW_KERNEL(cellRowEllipseDividers, 0, 1, 1)
+
+
+
+/* The size of the matrix part of the image, in pixels. */
+void getMatrixFeatureSize (
+		     BOOLEAN_T includeDividers,
+		     MATRIXINFO_T* matrixInfo,
+		     int* width,
+		     int* height
+		     )
+{
+  if (includeDividers) {
+    //    *height = matrixInfo->numrows * (ySize+1);
+    *height = matrixInfo->rowsToUse * (matrixInfo->yblocksize+1);
+    *width = matrixInfo->colsToUse * (matrixInfo->xblocksize+1);
+  } else {
+    //    *height = matrixInfo->numrows * ySize;
+    *height = matrixInfo->rowsToUse * matrixInfo->yblocksize;
+    *width = matrixInfo->colsToUse * matrixInfo->xblocksize;
+  }
+} /* getMatrixFeatureSize */
+
+
+
+/* Work out the range of values mapped onto the colors (leaving it in
+   matrixInfo->minval and maxval): the data's, or the one given. */
+void findImageRange (
+		     MTYPE** matrix,
+		     double contrast,
+		     BOOLEAN_T useDataRange,
+		     double minVal,
+		     double maxVal,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  double min = 0.0, max = 0.0;
+
+  if (matrixInfo->stats == NULL) {
+    matrixInfo->stats = get_rawmatrix_stats(matrix, matrixInfo->numrows, matrixInfo->numcols);
+  }
+  if (useDataRange && matrix[0] != NULL) {
+    if (matrixInfo->numrows > 0)
+      find_stats_range(matrix, matrixInfo->numrows, matrixInfo->numcols, matrixInfo->outliers, matrixInfo->stats, &min, &max);
+    min/=contrast;
+    max/=contrast;
+  } else {
+    max = maxVal;
+    min = minVal;
+  }
+  matrixInfo->minval = min;
+  matrixInfo->maxval = max;
+} /* findImageRange */
+
+
+
+/* Plan the matrix as the first feature of a layout. rawmatrix2img
+   then makes the image at the layout's final size and draws the
+   matrix where it has ended up; findImageRange must have been called
+   already. */
+void layoutMatrix (
+		     LAYOUT_T* layout,
+		     BOOLEAN_T includeDividers,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  int width, height;
+  int xoffset, yoffset;
+
+  getMatrixFeatureSize(includeDividers, matrixInfo, &width, &height);
+  layoutFeature(layout, "center", FALSE, &matrixInfo->ulx, &matrixInfo->uly,
+		matrixInfo->usedRegion, width, height, &xoffset, &yoffset);
+  matrixInfo->lrx = matrixInfo->ulx + width;
+  matrixInfo->lry = matrixInfo->uly + height;
+  trackLayoutCoords(layout, &matrixInfo->lrx, &matrixInfo->lry);
+  matrixInfo->dividers = includeDividers;
+  matrixInfo->layout = layout;
+} /* layoutMatrix */
+
+
+
+/* How the matrix rows are drawn, worked out once per image from the
+   color mapping and the kind of cell. */
+typedef struct matrixraster_t {
+  double min, max, stepsize; /* value to color mapping info */
+  BOOLEAN_T clip;         /* values outside min..max are possible */
+  int numColorsTotal;     /* in the palette the codes index */
+  int xSize, ySize;       /* block size, with the divider in xSize */
+  int runWidth, rowHeight; /* pixels per cell and matrix row */
+  int width;              /* of the whole matrix */
+  BOOLEAN_T dividers;
+  BOOLEAN_T ellipse;      /* cells are drawn as ellipses */
+  int* spanStart;         /* ellipse: [spanStart[r], spanEnd[r]) is */
+  int* spanEnd;           /* filled in pixel row r of a cell */
+  CELLROW_KERNEL_T kernel; /* lays out the cells of one pixel row */
+  unsigned char dividerColor;
+} MATRIXRASTER_T;
+
+
+static void initMatrixRaster (
+			     MATRIXRASTER_T* raster,
+			     double contrast,
+			     BOOLEAN_T useDataRange,
+			     BOOLEAN_T includeDividers,
+			     int numColorsTotal,
+			     int dividerColor,
+			     MATRIXINFO_T* matrixInfo
+			     )
+{
+  int height;
+  double range;
+
+  /* figure out the value-to-color mapping */
+  raster->min = matrixInfo->minval;
+  raster->max = matrixInfo->maxval;
+  range = raster->max - raster->min;
+  if (range == 0.0) {
+    if (verbosity > NORMAL_VERBOSE)
+      fprintf(stderr, "Warning: range of values in data is zero.\n");
+    range = 1; /* This just avoids getting a step size of zero. If all
+		  values in the data are equal, it results in all
+		  values showing up as the minimum value */
+  }
+  raster->stepsize = range / matrixInfo->numColors;
+  DEBUG_CODE(1, fprintf(stderr, "Min is %f, max is %f, Step size is %f\n", raster->min, raster->max, raster->stepsize););
+  DEBUG_CODE(1, fprintf(stderr, "Image will be %d x %d cells\n", matrixInfo->rowsToUse, matrixInfo->colsToUse););
+  raster->clip = !useDataRange || contrast != 1.0 || matrixInfo->outliers;
+  raster->numColorsTotal = numColorsTotal;
+  raster->dividerColor = (unsigned char)dividerColor;
+
+  /* (1 pixel dividers)*/
+  raster->dividers = includeDividers;
+  raster->xSize = includeDividers ? matrixInfo->xblocksize + 1 : matrixInfo->xblocksize;
+  raster->ySize = matrixInfo->yblocksize;
+  raster->runWidth = matrixInfo->xblocksize;
+  raster->rowHeight = includeDividers ? raster->ySize + 1 : raster->ySize;
+  getMatrixFeatureSize(includeDividers, matrixInfo, &raster->width, &height);
+
+  /* a one pixel wide ellipse is just a column */
+  raster->ellipse = matrixInfo->circles && raster->runWidth > 1;
+  if (raster->runWidth == 1) {
+    raster->kernel = includeDividers ? cellRowUnitDividers : cellRowUnit;
+  } else if (raster->ellipse) {
+    raster->kernel = includeDividers ? cellRowEllipseDividers : cellRowEllipse;
+  } else {
+    raster->kernel = includeDividers ? cellRowRectDividers : cellRowRect;
+  }
+
+  raster->spanStart = raster->spanEnd = NULL;
+  if (raster->ellipse) {
+    raster->spanStart = (int*)mymalloc(sizeof(int) * raster->ySize);
+    raster->spanEnd = (int*)mymalloc(sizeof(int) * raster->ySize);
+    ellipseSpans(raster->runWidth, raster->ySize, raster->spanStart, raster->spanEnd);
+  }
+} /* initMatrixRaster */
+
+
+static void freeMatrixRaster(MATRIXRASTER_T* raster)
+{
+  myfree(raster->spanStart);
+  myfree(raster->spanEnd);
+} /* freeMatrixRaster */
+
+
+/* Draw the blocks of one matrix row into the first numRows (at most
+   the block height) of rows, copyWidth pixels of each from column
+   x. The row's scanline is laid out with the row kernel for this kind
+   of cell, then copied down the block height; for ellipses each pixel
+   row of the block gets its own scanline, from the ellipse's span in
+   that row. Single-pixel cells without dividers need no scanline at
+   all: the colors are mapped straight into the first row. rowCodes
+   (a byte per column, and one spare) and scanline (a byte per pixel
+   of the matrix width, and one spare) are the caller's scratch
+   space, so rows can be drawn in parallel. */
+static void drawMatrixRow (
+			     MTYPE* values,
+			     MATRIXRASTER_T* raster,
+			     MATRIXINFO_T* matrixInfo,
+			     unsigned char** rows,
+			     int x,
+			     int numRows,
+			     int copyWidth,
+			     unsigned char* rowCodes,
+			     unsigned char* scanline
+			     )
+{
+  unsigned char* source;
+  int r;
+
+  if (raster->runWidth == 1 && !raster->dividers && copyWidth == raster->width) {
+    source = &rows[0][x];
+    mapValuesToColors(values, matrixInfo->colsToUse, raster->min, raster->max, raster->stepsize,
+		      raster->clip, raster->numColorsTotal, matrixInfo, source);
+  } else {
+    source = scanline;
+    mapValuesToColors(values, matrixInfo->colsToUse, raster->min, raster->max, raster->stepsize,
+		      raster->clip, raster->numColorsTotal, matrixInfo, rowCodes);
+    if (!raster->ellipse)
+      raster->kernel(rowCodes, matrixInfo->colsToUse, raster->xSize, raster->runWidth,
+		     raster->dividerColor, 0, 0, scanline);
+  }
+
+  for (r = 0; r < numRows; r++) {
+    if (raster->ellipse)
+      raster->kernel(rowCodes, matrixInfo->colsToUse, raster->xSize, raster->runWidth,
+		     raster->dividerColor, raster->spanStart[r], raster->spanEnd[r], scanline);
+    if (source != &rows[r][x])
+      memcpy(&rows[r][x], source, copyWidth);
+  }
+} /* drawMatrixRow */
+
+
+/* The palette index of the divider color, if there are dividers */
+static int findDividerColor(gdImagePtr img, BOOLEAN_T includeDividers)
+{
+  int r,g,b;
+  int dividerColor;
+
+  if (!includeDividers) return(0);
+  color2rgb((colorV_T*)DEFAULTDIVIDERCOLOR, &r, &g, &b);
+  dividerColor = gdImageColorClosest(img, r, g, b);
+  DEBUG_CODE(1, fprintf(stderr, "Including dividers %d %d %d %d\n", r, g, b, dividerColor););
+  return(dividerColor);
+} /* findDividerColor */
+
+
 /* Given a raw 2-d array structure make image */
 gdImagePtr rawmatrix2img (
 		     MTYPE** matrix,
@@ -107,190 +542,241 @@ gdImagePtr rawmatrix2img (
 		     )
 {
   gdImagePtr img; /* the image */
-  int i, j; /* counters */
-  int x, y; /* locations in the image */
-  int colorcode; /* current color */
-  double min, max; /* range values */
-  double range, stepsize; /* value to color mapping info */
+  int i; /* counter */
+  int y; /* location in the image */
   int width, height; /* size of image */
-  double value; /* value to be graphed */
+  int copyWidth; /* pixels of each matrix row inside the image */
+  MATRIXRASTER_T raster;
   int initX, initY; /* where we should start drawing the matrix */
   int xoffset, yoffset;
-  int featureWidth, featureHeight;
-  int dividerColor = 0;
-  int xSize = matrixInfo->xblocksize;
-  int ySize = matrixInfo->yblocksize;
-  char buf[10];
-  int* k;
-
-  /* create image to fit (1 pixel dividers)*/
-  if (includeDividers) {
-    xSize++;
-    //    height = matrixInfo->numrows * (ySize+1);
-    height = matrixInfo->rowsToUse * (ySize+1);
+  int dividerColor;
+
+  getMatrixFeatureSize(includeDividers, matrixInfo, &width, &height);
+
+  /* create the image: as planned, or to fit */
+  if (matrixInfo->layout != NULL) {
+    img = newCanvas(matrixInfo->layout->width, matrixInfo->layout->height, 0, 0);
   } else {
-    //    height = matrixInfo->numrows * ySize;
-    height = matrixInfo->rowsToUse * ySize;
+    DEBUG_CODE(1, fprintf(stderr, "Set image size to %d by %d\n", width, height););
+    img = newCanvas(width, height, DEFAULTCANVASRESERVE, DEFAULTCANVASRESERVE);
   }
-  //  width = matrixInfo->numcols * xSize;
-  width = matrixInfo->colsToUse * xSize;
-
-  featureWidth = width;
-  featureHeight = height;
-  
-  //  if (matrixInfo->xminSize > width) width = matrixInfo->xminSize;
-  //  if (matrixInfo->yminSize > height) height = matrixInfo->yminSize;
-  DEBUG_CODE(1, fprintf(stderr, "Set image size to %d by %d\n", width, height););
 
-  img = gdImageCreate(width, height);
+  allocateImageColors(img, backgroundColor, minColor, midColor, maxColor, missingColor, passThroughBlack, colorMap, matrixInfo);
+  dividerColor = findDividerColor(img, includeDividers);
 
-  /* allocate the colors */
-  if (colorMap) {
-    allocateColorMap(img, backgroundColor, missingColor, colorMap, matrixInfo);
-  } else if (matrixInfo->discreteMap != NULL) {
-    allocateColorsDiscrete(img, matrixInfo->discreteMap, backgroundColor, missingColor);
+  /* place the image (which is empty at this point), unless that has
+     been done already, with everything else, by layoutMatrix */
+  if (matrixInfo->layout != NULL) {
+    initX = matrixInfo->ulx;
+    initY = matrixInfo->uly;
   } else {
-    allocateColors(img, backgroundColor, minColor, midColor, maxColor, missingColor, passThroughBlack, matrixInfo->numColors);
+    placeFeature(img,
+		 "center",
+		 FALSE,
+		 &initX,
+		 &initY,
+		 matrixInfo->usedRegion,
+		 width,
+		 height, 
+		 &xoffset, &yoffset);
+    matrixInfo->ulx = xoffset;
+    matrixInfo->uly = yoffset;
+    matrixInfo->lrx = width + xoffset;
+    matrixInfo->lry = height + yoffset;
+    matrixInfo->dividers = includeDividers;
+    findImageRange(matrix, contrast, useDataRange, minVal, maxVal, matrixInfo);
   }
 
-  if (includeDividers) {
-    int r,g,b;
-    color2rgb((colorV_T*)DEFAULTDIVIDERCOLOR, &r, &g, &b);
-    dividerColor = gdImageColorClosest(img, r, g, b);
-    DEBUG_CODE(1, fprintf(stderr, "Including dividers %d %d %d %d\n", r, g, b, dividerColor););
-  }
-
-  /* place the image (which is empty at this point)*/
-  placeFeature(img,
-	       "center",
-	       FALSE,
-	       &initX,
-	       &initY,
-	       matrixInfo->usedRegion,
-	       featureWidth,
-	       featureHeight, 
-	       &xoffset, &yoffset);
-
   DEBUG_CODE(1, 
 	     if(img == NULL) die ("null image\n");
 	     );
 
   DEBUG_CODE(1, fprintf(stderr, "Image is %d by %d pixels; starting from %d, %d\n", gdImageSX(img), gdImageSY(img), initX, initY););
   
-  /* figure out the value-to-color mapping */
-  if (useDataRange && matrix[0] != NULL) {
-    if (matrixInfo->numrows > 0)
-      find_rawmatrix_min_and_max(matrix, matrixInfo->numrows, matrixInfo->numcols, matrixInfo->outliers, &min, &max);
-    min/=contrast;
-    max/=contrast;
-  } else {
-    max = maxVal;
-    min = minVal;
-  }
+  initMatrixRaster(&raster, contrast, useDataRange, includeDividers,
+		   gdImageColorsTotal(img), dividerColor, matrixInfo);
+
+  /* Write the palette indices straight into the image rather than
+     drawing a shape per cell. The matrix is the first feature in an
+     image made to its size, so this only clips in principle.
+
+     The image and its placement are fixed by now, and matrix row i
+     owns the pixel rows from its divider (if any) to the end of its
+     block, so the rows are split into bands, one per thread, which
+     map and draw their own rows with nothing shared but the
+     (read-only) matrix and color mapping. */
+  copyWidth = width;
+  if (initX + copyWidth > gdImageSX(img))
+    copyWidth = gdImageSX(img) - initX;
+
+#pragma omp parallel private(i, y)
+  {
+    unsigned char* rowCodes = (unsigned char*)mymalloc(matrixInfo->colsToUse + 1);
+    unsigned char* scanline = (unsigned char*)mymalloc(width + 1);
+
+#pragma omp for schedule(static)
+    for (i=0; i<matrixInfo->rowsToUse; i++) {
+      y = initY + i * raster.rowHeight;
+      if(includeDividers && i>0) {
+	if (y - 1 < gdImageSY(img) && copyWidth > 0)
+	  memset(&img->pixels[y - 1][initX], dividerColor, copyWidth);
+      }
+      if (y >= gdImageSY(img) || copyWidth <= 0)
+	continue;
 
-  range = max - min;
-  if (range == 0.0) {
-    if (verbosity > NORMAL_VERBOSE)
-      fprintf(stderr, "Warning: range of values in data is zero.\n");
-    range = 1; /* This just avoids getting a step size of zero. If all
-		  values in the data are equal, it results in all
-		  values showing up as the minimum value */
+      drawMatrixRow(matrix[i], &raster, matrixInfo, &img->pixels[y], initX,
+		    y + raster.ySize <= gdImageSY(img) ? raster.ySize : gdImageSY(img) - y,
+		    copyWidth, rowCodes, scanline);
+    }
+    myfree(scanline);
+    myfree(rowCodes);
   }
+  freeMatrixRaster(&raster);
   
-  stepsize = range / matrixInfo->numColors;
-  DEBUG_CODE(1, fprintf(stderr, "Min is %f, max is %f, Step size is %f\n", min, max, stepsize););
-  DEBUG_CODE(1, fprintf(stderr, "Image will be %d x %d cells\n", matrixInfo->rowsToUse, matrixInfo->colsToUse););
-  /* draw the image */
-  y = initY;
-  //  for (i=0; i<matrixInfo->numrows; i++) {
-  for (i=0; i<matrixInfo->rowsToUse; i++) {
-    x = initX;
-    if(includeDividers && i>0) {
-      gdImageLine(img, initX, y, initX + width, y, dividerColor);
-      y++;
-    }
-
-    //    for (j=0; j<matrixInfo->numcols; j++) {
-    for (j=0; j<matrixInfo->colsToUse; j++) {
-
-      /* DEBUG_CODE(1, fprintf(stderr, "Drawing at: %d %d\n", i,j);); */
-
-      value = matrix[i][j];
-
-      if (isnan(value)) { // missing value
-	colorcode = MISSING;
-      } else if (matrixInfo->discreteMap != NULL) { // discrete map
-	if (0) {
-	  value = value; // the old way....
-	} else { // hash way, allows flexibility in the values. Only
-		 // problem is that values in the file are coerced to
-		 // ints.
-	  sprintf(buf, "%d", (int)value);
-	  k = (int*)find(matrixInfo->discreteMap->mapping, buf);
-	  DEBUG_CODE(1, fprintf(stderr, "Seeking discrete map value for: %s", buf););
-	  if (k==NULL) {
-	    value = (double)(-1);
-	    DEBUG_CODE(1, fprintf(stderr, ": got null\n"););
-	  } else {
-	    value = (double)(*k);
-	    DEBUG_CODE(1, fprintf(stderr, ": got %d\n", (int)value););
-	  }
-	}
-	if (value > matrixInfo->discreteMap->count || value < 0) {
-	  colorcode = DEFAULT_DISCRETE_COLOR_INDEX;
-	} else {
-	  colorcode = (int)value + NUMRESERVEDCOLORS + 1;
-	  DEBUG_CODE(1, fprintf(stderr, "Colorcode %d for value %d\n", (int)colorcode, (int)value););
-	}
-      } else { // normal
-	/* clip color if necessary */
-	if (!useDataRange || contrast != 1.0 || matrixInfo->outliers) {
-	  if (value > max) {
-	    value = max;
-	  } else if (value < min) {
-	    value = min;
-	  }
-	}
-	colorcode = (int)(( (value - min) / stepsize) + NUMRESERVEDCOLORS);
-	if (colorcode > gdImageColorsTotal(img) - 1)
-	  colorcode = gdImageColorsTotal(img) - 1;
-      }
+  return img;
+} /* rawmatrix2img */
+
+
+
+/* Write the matrix, as rawmatrix2img would draw it, as a PNG of just
+   the matrix, without making the image */
+void rawmatrix2png (
+		     FILE* out,
+		     MTYPE** matrix,
+		     double contrast,
+		     BOOLEAN_T useDataRange,
+		     BOOLEAN_T includeDividers,
+		     BOOLEAN_T passThroughBlack,
+		     double minVal,
+		     double maxVal,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* backgroundColor,
+		     colorV_T* missingColor,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  gdImagePtr palette; /* holds just the colors */
+  PNGSTREAM_T* stream;
+  MATRIXRASTER_T raster;
+  int width, height;
+  int bandSize;       /* matrix rows drawn at a time */
+  unsigned char* band; /* their pixels */
+  unsigned char** bandRows;
+  int first, i;
+
+  getMatrixFeatureSize(includeDividers, matrixInfo, &width, &height);
+  if (matrixInfo->layout == NULL) {
+    matrixInfo->ulx = 0;
+    matrixInfo->uly = 0;
+    matrixInfo->lrx = width;
+    matrixInfo->lry = height;
+    matrixInfo->dividers = includeDividers;
+    findImageRange(matrix, contrast, useDataRange, minVal, maxVal, matrixInfo);
+  }
 
-      /* draw rectangle and advance to the next position */
-      if (matrixInfo->circles) {
-	int yRad = (int)ySize/2;
-	int xRad = (int)xSize/2;
-	if (includeDividers) {
-	  gdImageArc(img, x-1+xRad, y-1+yRad, xSize, ySize, 0, 360, colorcode);
-	  gdImageFill(img, x-1+xRad, y-1+yRad, colorcode);
-	  gdImageLine(img, x+xSize-1, y-1, x+xSize-1, y+ySize-1, dividerColor);
-	} else {
-	  gdImageArc(img, x+xRad, y+yRad, xSize, ySize, 0, 360, colorcode);
-	  gdImageFill(img, x+xRad, y+yRad, colorcode);
-	}
-      } else {
-	if (includeDividers) {
-	  gdImageFilledRectangle(img, x, y, x+xSize, y+ySize-1, colorcode);
-	  gdImageLine(img, x+xSize-1, y-1, x+xSize-1, y+ySize-1, dividerColor);
-	} else {
-	  gdImageFilledRectangle(img, x, y, x+xSize, y+ySize, colorcode);
-	}
+  palette = gdImageCreate(1, 1);
+  allocateImageColors(palette, backgroundColor, minColor, midColor, maxColor, missingColor, passThroughBlack, colorMap, matrixInfo);
+  initMatrixRaster(&raster, contrast, useDataRange, includeDividers,
+		   gdImageColorsTotal(palette), findDividerColor(palette, includeDividers), matrixInfo);
+
+  bandSize = MATRIXBANDHEIGHT / raster.rowHeight;
+  if (bandSize < 1) bandSize = 1;
+  if (bandSize > matrixInfo->rowsToUse) bandSize = matrixInfo->rowsToUse;
+  band = (unsigned char*)mymalloc((size_t)bandSize * raster.rowHeight * width);
+  bandRows = (unsigned char**)mymalloc(sizeof(unsigned char*) * bandSize * raster.rowHeight);
+  for (i=0; i<bandSize * raster.rowHeight; i++) {
+    bandRows[i] = band + (size_t)i * width;
+  }
+  DEBUG_CODE(1, fprintf(stderr, "Writing %d by %d pixels, %d matrix rows at a time\n", width, height, bandSize););
+
+  stream = openPngStream(out, palette, width, height);
+
+  /* Each band's matrix rows are drawn in parallel, as in
+     rawmatrix2img, and the band is written once they are done, outside
+     the drawing threads, so the PNG stream can compress it with all of
+     them. Matrix row i owns its block rows and, with dividers, the row
+     after them: a divider, or background after the last row. */
+  for (first=0; first<matrixInfo->rowsToUse; first+=bandSize) {
+    int numRows = first + bandSize <= matrixInfo->rowsToUse ? bandSize : matrixInfo->rowsToUse - first;
+
+#pragma omp parallel private(i)
+    {
+      unsigned char* rowCodes = (unsigned char*)mymalloc(matrixInfo->colsToUse + 1);
+      unsigned char* scanline = (unsigned char*)mymalloc(width + 1);
+
+#pragma omp for schedule(static)
+      for (i=0; i<numRows; i++) {
+	unsigned char** rows = &bandRows[i * raster.rowHeight];
+	drawMatrixRow(matrix[first + i], &raster, matrixInfo, rows, 0, raster.ySize,
+		      width, rowCodes, scanline);
+	if (raster.dividers)
+	  memset(rows[raster.ySize], first + i < matrixInfo->rowsToUse - 1 ? raster.dividerColor : 0, width);
       }
-      x+=xSize;
+      myfree(scanline);
+      myfree(rowCodes);
     }
-    y+=ySize;
+
+    writePngRows(stream, bandRows, numRows * raster.rowHeight);
   }
-  
-  matrixInfo->ulx = xoffset;
-  matrixInfo->uly = yoffset;
-  matrixInfo->lrx = featureWidth + xoffset;
-  matrixInfo->lry = featureHeight + yoffset;
-  matrixInfo->minval = min;
-  matrixInfo->maxval = max;
-  matrixInfo->dividers = includeDividers;
 
-  return img;
-} /* rawmatrix2img */
+  closePngStream(stream);
+  myfree(bandRows);
+  myfree(band);
+  freeMatrixRaster(&raster);
+  gdImageDestroy(palette);
+} /* rawmatrix2png */
+
+
+
+/*
+ * Move the row labels to follow rows reordered by order. Descriptions
+ * are only moved if there is one per row.
+ */
+static void reorderRowLabels(int* order, int numrows, STRING_LIST_T* rownames, STRING_LIST_T* desctext) {
+  permute_string_list(order, rownames);
+  if (desctext != NULL) {
+    if (get_num_strings(desctext) == numrows) {
+      permute_string_list(order, desctext);
+    } else {
+      fprintf(stderr, "Warning: %d descriptions for %d rows; not reordering them\n",
+	      get_num_strings(desctext), numrows);
+    }
+  }
+} /* reorderRowLabels */
+
+
+
+/*
+ * Which of the first num labels are names in the table, for -labelonly.
+ */
+static BOOLEAN_T* findListedLabels(STRING_LIST_T* labels, int num, HASHTABLE_T* listed) {
+  BOOLEAN_T* found = (BOOLEAN_T*)mycalloc(num, sizeof(BOOLEAN_T));
+  int i;
+
+  for (i = 0; i < num && i < get_num_strings(labels); i++) {
+    found[i] = find(listed, get_nth_string(i, labels)) != NULL;
+  }
+  return found;
+} /* findListedLabels */
+
+
+
+/*
+ * Labels for the first numnames rows or columns combined into numbins
+ * bins (as by bin_matrix): each bin is labeled with its first member.
+ */
+static STRING_LIST_T* binLabels(STRING_LIST_T* names, int numnames, int numbins) {
+  STRING_LIST_T* binned = new_string_list();
+  int i;
+
+  for (i = 0; i < numbins; i++) {
+    add_string(get_nth_string((int)((long)i * numnames / numbins), names), binned);
+  }
+  return binned;
+} /* binLabels */
 
 
 
@@ -311,7 +797,11 @@ int main (int argc, char **argv) {
   MATRIX_T* dataMatrix;
   RDB_MATRIX_T* rdbdataMatrix;
   USED_T* usedRegion; /* keep track of free space on the image canvas */
+  LAYOUT_T* layout; /* where everything goes on the canvas */
+  int matrixWidth, matrixHeight; /* of the matrix alone */
+  FEATURE_T rowNamesFeature, descTextFeature, colNamesFeature, scaleBarFeature, titleFeature;
   MTYPE** rawmatrix = NULL;
+  int i;
 
   int numactualrows = 0;
   int numactualcols = 0;
@@ -319,6 +809,7 @@ int main (int argc, char **argv) {
   /* command line options */
   BOOLEAN_T discrete = FALSE;
   BOOLEAN_T doscalebar = FALSE;
+  BOOLEAN_T scaleHistogram = FALSE;
   BOOLEAN_T dorownames = FALSE;
   BOOLEAN_T docolnames = FALSE;
   BOOLEAN_T dodividers = FALSE;
@@ -328,10 +819,15 @@ int main (int argc, char **argv) {
   BOOLEAN_T skipformatline = FALSE; /* if selected, assumes that we ARE using RDB format */
   BOOLEAN_T ellipses = FALSE; /* draw ellipses or circles instead of rectangles */
   BOOLEAN_T normalize = FALSE; /* normalize the rows */
+  BOOLEAN_T normalizeCols = FALSE; /* normalize the columns */
+  BOOLEAN_T transpose = FALSE; /* draw the rows as columns */
+  BOOLEAN_T robustNormalize = FALSE; /* normalize the rows by median and MAD */
+  BOOLEAN_T quantileNormalize = FALSE; /* give all columns the same distribution */
   BOOLEAN_T logTransform = FALSE;
   BOOLEAN_T colLabelsBottom = FALSE; /* Put column labels below the picture */
   BOOLEAN_T rowLabelsLeft = FALSE;
   BOOLEAN_T reverseJustification = FALSE;
+  BOOLEAN_T thinLabels = FALSE; /* label what fits instead of insisting on every row/column */
 
   double contrast = DEFAULTCONTRAST;
   int numcolors = DEFAULTNUMCOLORS;
@@ -352,6 +848,45 @@ int main (int argc, char **argv) {
 
   char* fontName = NULL;
 
+  /* correlate the rows or columns and draw that instead */
+  char* corrInput = NULL;
+  BOOLEAN_T corrByCols = FALSE;
+
+  /* reorder rows and/or columns by hierarchical clustering */
+  char* clusterInput = NULL;
+  char* linkageInput = NULL;
+  char* distanceInput = NULL;
+  BOOLEAN_T clusterRows = FALSE;
+  BOOLEAN_T clusterCols = FALSE;
+  linkage_T linkage = average_linkage;
+  distance_T distance = corr_distance;
+
+  /* shrink the matrix to fit in a given number of pixels */
+  char* fitInput = NULL;
+  char* aggregateInput = NULL;
+  int fitWidth = -1;
+  int fitHeight = -1;
+  binmode_T aggregate = mean_bins;
+
+  /* statistics saved from an earlier run on the same file */
+  char* statsFilename = NULL;
+  char statsSource[1024];
+
+  /* also write a zoomable tile pyramid here */
+  char* tilesDir = NULL;
+
+  /* how the PNGs are compressed */
+  int pngCompression = PNGDEFAULTCOMPRESSION;
+  char* pngFilterInput = NULL;
+  char* pngStrategyInput = NULL;
+  pngfilter_T pngFilter = default_filter;
+  pngstrategy_T pngStrategy = default_strategy;
+
+  /* sort the rows by a computed key */
+  char* sortInput = NULL;
+  rowkey_T sortKey = mean_key;
+  int sortCol = -1;
+
   /* user-specified range for values represented in the image */
   double min = (double)FLT_MAX;
   double max = (double)FLT_MIN;
@@ -384,6 +919,8 @@ int main (int argc, char **argv) {
   STRING_LIST_T* rownames = NULL;
   STRING_LIST_T* colnames = NULL;
   STRING_LIST_T* desctext = NULL;
+  char* labelOnlyFilename = NULL;
+  HASHTABLE_T* labelOnly = NULL;
 
   /* outputs to files */
   char* outFilename = NULL;
@@ -442,8 +979,46 @@ int main (int argc, char **argv) {
 	       errFilename = _OPTION_);
      DATA_OPTN(1, verbose, : Verbosity of the output 1|2|3|4|5 (default=2),
 	       verbosity = (VERBOSE_T)atoi(_OPTION_));
+     DATA_OPTN(1, corr, rows|cols : Draw the correlation matrix of the rows or columns instead of the data (using only the rows and columns within -numr and -numc),
+	       corrInput = _OPTION_);
+     DATA_OPTN(1, cluster, rows|cols|both : Reorder the rows and/or columns by hierarchical clustering,
+	       clusterInput = _OPTION_);
+     DATA_OPTN(1, linkage, average|complete : Linkage used by -cluster (default = average),
+	       linkageInput = _OPTION_);
+     DATA_OPTN(1, distance, corr|euclid : Distance used by -cluster (default = corr: one minus the correlation),
+	       distanceInput = _OPTION_);
+     DATA_OPTN(1, sortrows, mean|var|max|col:NAME : Sort the rows by their mean/variance/maximum or by the values in a column,
+	       sortInput = _OPTION_);
+     DATA_OPTN(1, fit, WxH : Combine rows and columns so that the matrix is at most W by H pixels (with -d the pitch of each block includes its divider),
+	       fitInput = _OPTION_);
+     DATA_OPTN(1, aggregate, mean|maxabs|max|min : How -fit combines values (default = mean),
+	       aggregateInput = _OPTION_);
+     DATA_OPTN(1, tiles, <directory> : Also write a Deep Zoom tile pyramid (one pixel per value; levels combined as for -aggregate),
+	       tilesDir = _OPTION_);
+     DATA_OPTN(1, statsfile, <file> : Keep the data range and trimming bounds in this file to save work when drawing the same data again,
+	       statsFilename = _OPTION_);
+     DATA_OPTN(1, labelonly, <file> : Label only the rows and columns named in this file (one per line; implies -thin),
+	       labelOnlyFilename = _OPTION_);
+     DATA_OPTN(1, pngcompress, 0..9 : PNG compression level: 0 stores the image uncompressed and is fastest; 9 is smallest (default = 6),
+	       pngCompression = atoi(_OPTION_));
+     DATA_OPTN(1, pngfilter, none|sub|up|adaptive : How PNG rows are filtered before compression (default = none),
+	       pngFilterInput = _OPTION_);
+     DATA_OPTN(1, pngstrategy, default|filtered|rle|huffman : zlib strategy for PNG compression (rle is fast but misses repeated rows),
+	       pngStrategyInput = _OPTION_);
      DATA_OPTN(1, title, <title>: Add a title, titleText = (_OPTION_));
-     DATA_OPTN(1, font, <font name>: Choose font other than default if supported, fontName =(_OPTION_));
+     DATA_OPTN(1, font, <font name>: TrueType font file (or name to look for along GDFONTPATH) for the row and column labels if supported, fontName =(_OPTION_));
+     SIMPLE_FLAG_OPTN(1, transpose, : Swap rows and columns after reading (-numr etc. still refer to the file),
+	       transpose);
+     SIMPLE_FLAG_OPTN(1, zcol, : Column-normalize the data to mean 0 and variance 1 (after -z if both are given),
+	       normalizeCols);
+     SIMPLE_FLAG_OPTN(1, zrobust, : Row-normalize the data to median 0 and median absolute deviation 1 (resists outliers better than -z),
+	       robustNormalize);
+     SIMPLE_FLAG_OPTN(1, quantile, : Quantile-normalize the columns (before any row or column normalization),
+	       quantileNormalize);
+     SIMPLE_FLAG_OPTN(1, thin, : Label only as many rows and columns as the font has room for when the blocks are too small to label them all,
+	       thinLabels);
+     SIMPLE_FLAG_OPTN(1, hist, : Draw a histogram of the data values under the scale bar (implies -s; not for discrete maps),
+	       scaleHistogram);
      CFLAG_OPTN(1, z, Row-normalize the data to mean 0 and variance 1, normalize = TRUE); 
      CFLAG_OPTN(1, b, Middle of color range is black, passThroughBlack = TRUE);
      CFLAG_OPTN(1, d, Add cell dividers, dodividers = TRUE);
@@ -494,10 +1069,139 @@ int main (int argc, char **argv) {
   if (discreteMappingFileName != NULL)
     discrete = TRUE;
 
+  if (fitInput != NULL) {
+    double parseval1, parseval2;
+    parseValuePair(fitInput, "x" DIVIDER, &parseval1, &parseval2);
+    /* with dividers, each block takes one more pixel each way */
+    fitWidth = (int)parseval1 / (dodividers ? xpixSize + 1 : xpixSize);
+    fitHeight = (int)parseval2 / (dodividers ? ypixSize + 1 : ypixSize);
+    if (fitWidth <= 0 || fitHeight <= 0) die("Illegal values for -fit: must be at least one block (%d by %d pixels)\n",
+					     dodividers ? xpixSize + 1 : xpixSize, dodividers ? ypixSize + 1 : ypixSize);
+  }
+  if (pngFilterInput != NULL) {
+    if (strcmp(pngFilterInput, "none") == 0) {
+      pngFilter = none_filter;
+    } else if (strcmp(pngFilterInput, "sub") == 0) {
+      pngFilter = sub_filter;
+    } else if (strcmp(pngFilterInput, "up") == 0) {
+      pngFilter = up_filter;
+    } else if (strcmp(pngFilterInput, "adaptive") == 0) {
+      pngFilter = adaptive_filter;
+    } else {
+      die("-pngfilter must be followed by 'none', 'sub', 'up' or 'adaptive'\n");
+    }
+  }
+  if (pngStrategyInput != NULL) {
+    if (strcmp(pngStrategyInput, "default") == 0) {
+      pngStrategy = default_strategy;
+    } else if (strcmp(pngStrategyInput, "filtered") == 0) {
+      pngStrategy = filtered_strategy;
+    } else if (strcmp(pngStrategyInput, "rle") == 0) {
+      pngStrategy = rle_strategy;
+    } else if (strcmp(pngStrategyInput, "huffman") == 0) {
+      pngStrategy = huffman_strategy;
+    } else {
+      die("-pngstrategy must be followed by 'default', 'filtered', 'rle' or 'huffman'\n");
+    }
+  }
+  setPngCompression(pngCompression, pngFilter, pngStrategy);
+
+  if (aggregateInput != NULL) {
+    if (strcmp(aggregateInput, "mean") == 0) {
+      aggregate = mean_bins;
+    } else if (strcmp(aggregateInput, "maxabs") == 0) {
+      aggregate = maxabs_bins;
+    } else if (strcmp(aggregateInput, "max") == 0) {
+      aggregate = max_bins;
+    } else if (strcmp(aggregateInput, "min") == 0) {
+      aggregate = min_bins;
+    } else {
+      die("-aggregate must be followed by 'mean', 'maxabs', 'max' or 'min'\n");
+    }
+    if (fitInput == NULL && tilesDir == NULL) {
+      fprintf(stderr, "Warning: -aggregate only applies with -fit or -tiles\n");
+    }
+  }
+
   if (outliers && rangeInput) {
     die("Cannot specifiy outlier trimming as well as the -range option\n");
   }
 
+  if (scaleHistogram) {
+    if (discrete) {
+      fprintf(stderr, "Warning: -hist is ignored with discrete mapping\n");
+      scaleHistogram = FALSE;
+    } else {
+      doscalebar = TRUE;
+    }
+  }
+
+  if (corrInput != NULL) {
+    if (strcmp(corrInput, "rows") == 0) {
+      corrByCols = FALSE;
+    } else if (strcmp(corrInput, "cols") == 0) {
+      corrByCols = TRUE;
+    } else {
+      die("-corr must be followed by 'rows' or 'cols'\n");
+    }
+    if (discrete) {
+      die("Cannot use -corr with discrete mapping\n");
+    }
+  }
+
+  if (clusterInput != NULL) {
+    if (strcmp(clusterInput, "rows") == 0) {
+      clusterRows = TRUE;
+    } else if (strcmp(clusterInput, "cols") == 0) {
+      clusterCols = TRUE;
+    } else if (strcmp(clusterInput, "both") == 0) {
+      clusterRows = clusterCols = TRUE;
+    } else {
+      die("-cluster must be followed by 'rows', 'cols' or 'both'\n");
+    }
+  }
+  if (linkageInput != NULL) {
+    if (strcmp(linkageInput, "average") == 0) {
+      linkage = average_linkage;
+    } else if (strcmp(linkageInput, "complete") == 0) {
+      linkage = complete_linkage;
+    } else {
+      die("-linkage must be followed by 'average' or 'complete'\n");
+    }
+  }
+  if (distanceInput != NULL) {
+    if (strcmp(distanceInput, "corr") == 0) {
+      distance = corr_distance;
+    } else if (strcmp(distanceInput, "euclid") == 0) {
+      distance = euclid_distance;
+    } else {
+      die("-distance must be followed by 'corr' or 'euclid'\n");
+    }
+  }
+  if (sortInput != NULL) {
+    if (strcmp(sortInput, "mean") == 0) {
+      sortKey = mean_key;
+    } else if (strcmp(sortInput, "var") == 0) {
+      sortKey = variance_key;
+    } else if (strcmp(sortInput, "max") == 0) {
+      sortKey = max_key;
+    } else if (strncmp(sortInput, "col:", 4) == 0 && sortInput[4] != '\0') {
+      sortKey = column_key;
+    } else {
+      die("-sortrows must be followed by 'mean', 'var', 'max' or 'col:NAME'\n");
+    }
+    if (clusterRows) {
+      die("Choose only one of -sortrows and -cluster rows\n");
+    }
+  }
+  if ((linkageInput != NULL || distanceInput != NULL) && clusterInput == NULL) {
+    fprintf(stderr, "Warning: -linkage and -distance only apply with -cluster\n");
+  }
+
+  if (normalize && robustNormalize) {
+    die("Choose only one of -z and -zrobust\n");
+  }
+
   if (outliers < 0.0 || outliers > 50.0) {
     die("Please select an outlier trimming value that is a valid percentage value between 0 and 50.\n");
   }
@@ -514,6 +1218,19 @@ int main (int argc, char **argv) {
     startc--;
   }
 
+  /* The statistics file is only good for this file, unchanged, read
+     the same way. */
+  if (statsFilename != NULL) {
+    struct stat fileInfo;
+    if (!strcmp(dataFilename, "-") || stat(dataFilename, &fileInfo) != 0) {
+      fprintf(stderr, "Warning: -statsfile needs the data to come from a file; ignoring it\n");
+      statsFilename = NULL;
+    } else {
+      sprintf(statsSource, "%.900s %ld %ld %d %d %d %d", dataFilename,
+	      (long)fileInfo.st_size, (long)fileInfo.st_mtime, numr, numc, startr, startc);
+    }
+  }
+
   /* read data */
   DEBUG_CODE(1, fprintf(stderr, "Reading data\n"););
   if (!strcmp(dataFilename, "-")) { /* read from stdin */
@@ -523,6 +1240,12 @@ int main (int argc, char **argv) {
     rdbdataMatrix = read_rdb_matrix_wmissing(skipformatline, dataFile, numr, numc, startr, startc);
     fclose(dataFile);
   }
+  if (transpose) {
+    int swap;
+    transpose_rdb_matrix(rdbdataMatrix);
+    swap = numr; numr = numc; numc = swap;
+    swap = startr; startr = startc; startc = swap;
+  }
   dataMatrix = get_raw_matrix(rdbdataMatrix);
   DEBUG_CODE(1, fprintf(stderr, "Done reading\n"););
   numactualrows = get_num_rows(dataMatrix);
@@ -535,11 +1258,9 @@ int main (int argc, char **argv) {
   if (numactualcols == 0 && numc > 0)
     die("No columns read\n");
 
-  if (dorownames)
-    rownames = get_row_names(rdbdataMatrix);
-
-  if (docolnames)
-    colnames = get_col_names(rdbdataMatrix);
+  /* kept even if not drawn, as reordering and -sortrows use them */
+  rownames = get_row_names(rdbdataMatrix);
+  colnames = get_col_names(rdbdataMatrix);
 
   if (numr < 0 || numr > numactualrows)
     numr = numactualrows;    
@@ -603,6 +1324,20 @@ int main (int argc, char **argv) {
     scalar_mult_matrix(oneOverLog2, dataMatrix);
   }
 
+  if (quantileNormalize) {
+    if (discrete) {
+      fprintf(stderr, "Warning: normalizing a file for use with discrete mapping will probably yield undesirable results\n");
+    }
+    quantile_normalize_matrix_cols(dataMatrix);
+  }
+
+  if (robustNormalize) {
+    if (discrete) {
+      fprintf(stderr, "Warning: normalizing a file for use with discrete mapping will probably yield undesirable results\n");
+    }
+    robust_normalize_matrix_rows(dataMatrix);
+  }
+
   if (normalize) {
     if (discrete) {
       fprintf(stderr, "Warning: normalizing a file for use with discrete mapping will probably yield undesirable results\n");
@@ -611,6 +1346,31 @@ int main (int argc, char **argv) {
     variance_one_matrix_rows(dataMatrix);
   }
 
+  if (normalizeCols) {
+    if (discrete) {
+      fprintf(stderr, "Warning: normalizing a file for use with discrete mapping will probably yield undesirable results\n");
+    }
+    z_score_matrix_cols(dataMatrix);
+  }
+
+  /* Replace the data with its correlation matrix. The new matrix is
+     square, with the same labels along both sides. Only the rows and
+     columns selected with -numr and -numc are used. */
+  if (corrInput != NULL) {
+    STRING_LIST_T* varNames = corrByCols ? get_col_names(rdbdataMatrix) : get_row_names(rdbdataMatrix);
+
+    if (numr < numactualrows || numc < numactualcols) {
+      dataMatrix = crop_matrix(numr, numc, dataMatrix);
+      set_raw_matrix(dataMatrix, rdbdataMatrix);
+    }
+    dataMatrix = correlation_matrix(corrByCols, dataMatrix);
+    set_raw_matrix(dataMatrix, rdbdataMatrix);
+    numactualrows = numactualcols = get_num_rows(dataMatrix);
+    numr = numc = numactualrows;
+    rownames = colnames = varNames;
+    DEBUG_CODE(1, fprintf(stderr, "Correlation matrix is %d by %d\n", numactualrows, numactualcols););
+  }
+
   /* read descriptive text if needed */
   if (descFilename != NULL) {
     dodesctext = TRUE;
@@ -618,7 +1378,101 @@ int main (int argc, char **argv) {
     desctext = read_string_list(descFile);
     fclose(descFile);
   }
+
+  /* read the names to label, into a table to look the labels up in */
+  if (labelOnlyFilename != NULL) {
+    FILE* labelOnlyFile;
+    STRING_LIST_T* names;
+    if (open_file(labelOnlyFilename, "r", FALSE, "labels", "the names to label", &labelOnlyFile) == 0) exit (1);
+    names = read_string_list(labelOnlyFile);
+    fclose(labelOnlyFile);
+    labelOnly = inittable(DEFAULT_TABLE_SIZE);
+    for (i = 0; i < get_num_strings(names); i++) {
+      if (strlen(get_nth_string(i, names)) > 0)
+	insert(labelOnly, get_nth_string(i, names), labelOnly); /* any non-NULL value */
+    }
+    free_string_list(names);
+    thinLabels = TRUE;
+  }
+
+  /* -corr labels both sides with one list; they may now be reordered
+     separately. */
+  if ((sortInput != NULL || clusterInput != NULL) && rownames == colnames) {
+    colnames = copy_string_list(colnames);
+  }
+
+  /* Sort the rows. Like clustering, this only moves row pointers and
+     labels. */
+  if (sortInput != NULL) {
+    ARRAY_T* keys;
+    int* order;
+
+    if (sortKey == column_key) {
+      for (sortCol = 0; sortCol < get_num_strings(colnames); sortCol++) {
+	if (strcmp(get_nth_string(sortCol, colnames), sortInput + 4) == 0)
+	  break;
+      }
+      if (sortCol == get_num_strings(colnames))
+	die("No column named %s to sort by\n", sortInput + 4);
+    }
+    keys = get_matrix_row_keys(sortKey, sortCol, dataMatrix);
+    order = get_sort_order(FALSE, keys);
+    permute_matrix_rows(order, dataMatrix);
+    reorderRowLabels(order, numactualrows, rownames, desctext);
+    free_array(keys);
+    myfree(order);
+  }
+
+  /* Cluster, then draw in the order of the leaves of the tree. Only the
+     row pointers and labels move; the values are unchanged, so any
+     statistics gathered while reading still hold. */
+  if (clusterRows || clusterCols) {
+    int* order;
+
+    if (clusterRows) {
+      DEBUG_CODE(1, fprintf(stderr, "Clustering %d rows\n", numactualrows););
+      order = cluster_order(FALSE, linkage, distance, dataMatrix);
+      permute_matrix_rows(order, dataMatrix);
+      reorderRowLabels(order, numactualrows, rownames, desctext);
+      myfree(order);
+    }
+    if (clusterCols) {
+      DEBUG_CODE(1, fprintf(stderr, "Clustering %d columns\n", numactualcols););
+      order = cluster_order(TRUE, linkage, distance, dataMatrix);
+      permute_matrix_cols(order, dataMatrix);
+      permute_string_list(order, colnames);
+      myfree(order);
+    }
+  }
   
+  /* Combine rows and/or columns to fit the pixel budget, after any
+     reordering so that neighbors in the picture are what get merged.
+     Only the rows and columns to be drawn (-numr, -numc) are kept. */
+  if (fitInput != NULL && (numr > fitHeight || numc > fitWidth)) {
+    int numrowbins = numr > fitHeight ? fitHeight : numr;
+    int numcolbins = numc > fitWidth ? fitWidth : numc;
+
+    if (discrete && aggregate == mean_bins) {
+      fprintf(stderr, "Warning: averaging values for use with discrete mapping will probably yield undesirable results\n");
+    }
+    DEBUG_CODE(1, fprintf(stderr, "Binning %d by %d to %d by %d\n", numr, numc, numrowbins, numcolbins););
+    if (numrowbins < numr) {
+      if (desctext != NULL && get_num_strings(desctext) == numactualrows)
+	desctext = binLabels(desctext, numr, numrowbins);
+      rownames = binLabels(rownames, numr, numrowbins);
+    }
+    if (numcolbins < numc)
+      colnames = binLabels(colnames, numc, numcolbins);
+    if (numr < numactualrows || numc < numactualcols) {
+      dataMatrix = crop_matrix(numr, numc, dataMatrix);
+      set_raw_matrix(dataMatrix, rdbdataMatrix);
+    }
+    dataMatrix = bin_matrix(numrowbins, numcolbins, aggregate, dataMatrix);
+    set_raw_matrix(dataMatrix, rdbdataMatrix);
+    numactualrows = numr = numrowbins;
+    numactualcols = numc = numcolbins;
+  }
+
   /* redirect stdout and/or stderr to file(s) if needed */
   if (errFilename != NULL) {
     if(freopen(errFilename, "w", stderr) == NULL) {
@@ -659,46 +1513,129 @@ int main (int argc, char **argv) {
   matrixInfo->reverseJustification = reverseJustification;
   matrixInfo->colLabelsBottom = colLabelsBottom;
   matrixInfo->fontName = fontName;
+  matrixInfo->scaleHistogram = scaleHistogram;
+  matrixInfo->thinLabels = thinLabels;
+  if (labelOnly != NULL) {
+    matrixInfo->rowLabelCandidates = findListedLabels(rownames, numactualrows, labelOnly);
+    matrixInfo->colLabelCandidates = findListedLabels(colnames, numactualcols, labelOnly);
+  }
+
+  /* What the reader gathered still describes the data unless it has
+     been transformed since; otherwise it is recomputed when drawing. */
+  if (!(logTransform || quantileNormalize || robustNormalize || normalize || normalizeCols)) {
+    matrixInfo->stats = get_rdb_stats(rdbdataMatrix);
+  }
+
+  /* Take the trimming bounds from the statistics file, or if it is
+     missing or out of date, work them out and save them for next
+     time. */
+  if (statsFilename != NULL) {
+    int fileRows = transpose ? numactualcols : numactualrows;
+    int fileCols = transpose ? numactualrows : numactualcols;
+    if (matrixInfo->stats == NULL) {
+      fprintf(stderr, "Warning: -statsfile only applies to untransformed data; ignoring it\n");
+    } else if (read_stats_file(statsFilename, statsSource, fileRows, fileCols, matrixInfo->stats)) {
+      DEBUG_CODE(1, fprintf(stderr, "Using statistics from %s\n", statsFilename););
+    } else {
+      DEBUG_CODE(1, fprintf(stderr, "Saving statistics to %s\n", statsFilename););
+      compute_stats_trims(dataMatrix, matrixInfo->stats);
+      write_stats_file(statsFilename, statsSource, fileRows, fileCols, matrixInfo->stats);
+    }
+  }
 
   DEBUG_CODE(1, dumpMatrixInfo(matrixInfo););
   
-  DEBUG_CODE(1, fprintf(stderr, "Building image\n"););
-  /* make the image as specified */
-  img = matrix2img(dataMatrix, contrast, useDataRange, dodividers, passThroughBlack,
-		   min, max,
-		   minColor,
-		   midColor,
-		   maxColor,
-		   bkgColor,
-		   missingColor,
-		   colorMap,
-		   matrixInfo, 
-		   rawmatrix);
-  
-  /* add extra goodies: (the order matters because of primitive
-     feature placement routine) */
-    if (dorownames) addRowLabels(img, rownames, matrixInfo);
-    if (dodesctext) addRowLabels(img, desctext, matrixInfo);
-    if (docolnames) addColLabels(img, colnames, matrixInfo);
-    if (doscalebar) addScaleBar(img, matrixInfo);
-    if (titleText != NULL) addTitle(img, matrixInfo, titleText);
-
-  // enlarge the canvas if requested (todo: make this a function call)
-  if (matrixInfo->xminSize > gdImageSX(img) || matrixInfo->yminSize > gdImageSY(img)) {
-    int newxsize = matrixInfo->xminSize > gdImageSX(img) ? matrixInfo->xminSize :  gdImageSX(img);
-    int newxplace = matrixInfo->xminSize > gdImageSX(img) ? floor((matrixInfo->xminSize -  gdImageSX(img))/2) :  0;
-    int newysize = matrixInfo->yminSize > gdImageSY(img) ? matrixInfo->yminSize :  gdImageSY(img);
-    int newyplace = matrixInfo->yminSize > gdImageSY(img) ? floor((matrixInfo->yminSize -  gdImageSY(img))/2) :  0;
-    enlargeCanvas(img, newxsize, newysize, newxplace, newyplace);
-  }
-  /* output */
-  gdImagePng(img, stdout);
+  /* the rows as rawmatrix2img takes them */
+  rawmatrix = (MTYPE**)mymalloc(matrixInfo->numrows*sizeof(MTYPE*));
+  for (i=0; i<matrixInfo->numrows; i++) {
+    rawmatrix[i] = get_matrix_row(i, dataMatrix)->items;
+  }
+  findImageRange(rawmatrix, contrast, useDataRange, min, max, matrixInfo);
+
+  /* Lay out the whole image before drawing any of it, so the canvas
+     is made just once, at its final size. The features are measured
+     and placed around the matrix in turn (the order matters because
+     of primitive feature placement routine); each one's position is
+     kept up to date as later ones grow the canvas. */
+  layout = initLayout();
+  layoutMatrix(layout, dodividers, matrixInfo);
+  if (dorownames) layoutRowLabels(layout, &rowNamesFeature, rownames, matrixInfo);
+  if (dodesctext) layoutRowLabels(layout, &descTextFeature, desctext, matrixInfo);
+  if (docolnames) layoutColLabels(layout, &colNamesFeature, colnames, matrixInfo);
+  if (doscalebar) layoutScaleBar(layout, &scaleBarFeature, matrixInfo);
+  if (titleText != NULL) layoutTitle(layout, &titleFeature, matrixInfo, titleText);
+
+  // enlarge the canvas if requested
+  if (matrixInfo->xminSize > layout->width || matrixInfo->yminSize > layout->height) {
+    int newxsize = matrixInfo->xminSize > layout->width ? matrixInfo->xminSize :  layout->width;
+    int newxplace = matrixInfo->xminSize > layout->width ? floor((matrixInfo->xminSize -  layout->width)/2) :  0;
+    int newysize = matrixInfo->yminSize > layout->height ? matrixInfo->yminSize :  layout->height;
+    int newyplace = matrixInfo->yminSize > layout->height ? floor((matrixInfo->yminSize -  layout->height)/2) :  0;
+    growLayout(layout, newxsize, newysize, newxplace, newyplace);
+  }
+
+  /* If there is nothing but the matrix, it is written out as it is
+     drawn, a band of rows at a time, and no image is made. */
+  img = NULL;
+  getMatrixFeatureSize(dodividers, matrixInfo, &matrixWidth, &matrixHeight);
+  if (layout->width == matrixWidth && layout->height == matrixHeight) {
+    DEBUG_CODE(1, fprintf(stderr, "Writing the matrix as it is drawn\n"););
+    rawmatrix2png(stdout, rawmatrix, contrast, useDataRange, dodividers, passThroughBlack,
+		  min, max,
+		  minColor,
+		  midColor,
+		  maxColor,
+		  bkgColor,
+		  missingColor,
+		  colorMap,
+		  matrixInfo);
+  } else {
+    DEBUG_CODE(1, fprintf(stderr, "Building image\n"););
+    /* make the image as specified */
+    img = rawmatrix2img(rawmatrix, contrast, useDataRange, dodividers, passThroughBlack,
+		      min, max,
+		      minColor,
+		      midColor,
+		      maxColor,
+		      bkgColor,
+		      missingColor,
+		      colorMap,
+		      matrixInfo);
+
+    /* add extra goodies, where they were laid out */
+    if (dorownames) addRowLabels(img, rownames, &rowNamesFeature, matrixInfo);
+    if (dodesctext) addRowLabels(img, desctext, &descTextFeature, matrixInfo);
+    if (docolnames) addColLabels(img, colnames, &colNamesFeature, matrixInfo);
+    if (doscalebar) addScaleBar(img, &scaleBarFeature, matrixInfo);
+    if (titleText != NULL) addTitle(img, &titleFeature, titleText);
+    /* output */
+    writeImagePng(img, stdout);
+  }
+
+  /* the tiles use the range just chosen for the image, so the colors
+     agree at every zoom level */
+  if (tilesDir != NULL) {
+    DEBUG_CODE(1, fprintf(stderr, "Writing tiles to %s\n", tilesDir););
+    writeTilePyramid(tilesDir, dataMatrix, aggregate,
+		     !useDataRange || contrast != 1.0 || outliers,
+		     passThroughBlack, minColor, midColor, maxColor,
+		     bkgColor, missingColor, colorMap, matrixInfo);
+  }
+
 
   /* clean up */
-  //  gdImageDestroy(img);
+  if (img != NULL) freeCanvas(img);
+  freeTTFonts();
   /*free_rdb_matrix(rdbdataMatrix); */
   free_matrix(dataMatrix);
   free(usedRegion);
+  free(layout);
+  if (matrixInfo->stats != get_rdb_stats(rdbdataMatrix)) {
+    free_matrix_stats(matrixInfo->stats);
+  }
+  myfree(matrixInfo->rowLabelCandidates);
+  myfree(matrixInfo->colLabelCandidates);
+  if (labelOnly != NULL) freetable(labelOnly);
   free(matrixInfo);
   free(rawmatrix);
   
@@ -34,6 +34,9 @@
 #define DEFAULTXPIXSIZE 2
 #define DEFAULTYPIXSIZE 2
 
+/* about how many pixel rows rawmatrix2png draws before writing them */
+#define MATRIXBANDHEIGHT 256
+
 /* function which: given a matrix, and some other information, returns
  * a pointer to a gdimage object */
 gdImagePtr matrix2img (
@@ -79,4 +82,96 @@ gdImagePtr rawmatrix2img (
 		     );
 
 
+/* Write the matrix straight out as a PNG, as rawmatrix2img would draw
+   it on an image of just the matrix, without making that image: the
+   rows are drawn and compressed a band at a time, so only the band is
+   ever in memory. Takes the same arguments as rawmatrix2img. */
+void rawmatrix2png (
+		     FILE* out,
+		     MTYPE** matrix,
+		     double contrast,
+		     BOOLEAN_T useDataRange,
+		     BOOLEAN_T includeDividers,
+		     BOOLEAN_T passThroughBlack,
+		     double minVal,
+		     double maxVal,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* backgroundColor,
+		     colorV_T* missingColor,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     );
+
+
+/* The size of the matrix part of the image, in pixels. */
+void getMatrixFeatureSize (
+		     BOOLEAN_T includeDividers,
+		     MATRIXINFO_T* matrixInfo,
+		     int* width,
+		     int* height
+		     );
+
+/* Find the range of values to map onto the colors, for
+   rawmatrix2img and anything laid out with it (the scale bar). */
+void findImageRange (
+		     MTYPE** matrix,
+		     double contrast,
+		     BOOLEAN_T useDataRange,
+		     double minVal,
+		     double maxVal,
+		     MATRIXINFO_T* matrixInfo
+		     );
+
+/* Start a layout with the matrix; if this is used, rawmatrix2img
+   makes the image at the layout's size. */
+void layoutMatrix (
+		     LAYOUT_T* layout,
+		     BOOLEAN_T includeDividers,
+		     MATRIXINFO_T* matrixInfo
+		     );
+
+/* Allocate the palette used for the matrix: a preset map, a discrete
+   map, or the graded colors. */
+void allocateImageColors (
+		     gdImagePtr img,
+		     colorV_T* backgroundColor,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* missingColor,
+		     BOOLEAN_T passThroughBlack,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     );
+
+/* The palette index for a value, with min, max and stepsize as
+   chosen by rawmatrix2img (and left in matrixInfo). */
+int valueColorCode (
+		     double value,
+		     double min,
+		     double max,
+		     double stepsize,
+		     BOOLEAN_T clip, /* clamp values outside min..max */
+		     int numColorsTotal,
+		     MATRIXINFO_T* matrixInfo
+		     );
+
+
+/* Map a row of values to palette indices (as valueColorCode does for
+   one value), writing one byte per value into codes. */
+void mapValuesToColors (
+		     MTYPE* values,
+		     int numValues,
+		     double min,
+		     double max,
+		     double stepsize,
+		     BOOLEAN_T clip,
+		     int numColorsTotal,
+		     MATRIXINFO_T* matrixInfo,
+		     unsigned char* codes
+		     );
+
+
 #endif /* matrix2png.h */
@@ -4,6 +4,7 @@
 
 #include "utils.h"
 #include "matrix.h"
+#include "matrixstats.h"
 #include "hash.h"
 #include "colors.h"
 #include "string-list.h"
@@ -15,14 +16,14 @@
 typedef struct discretemap_t 
 {
   colorV_T**     colors;
-  HASHTABLE_T*   mapping; // mapping of integer values to
-			  // colors. (keys are stringified values),
-			  // read from the file. This is a map of
-			  // "values" to "consecints". Could be
-			  // better!
   int*           values; // the Values that are expected to be present
-			 // in the data.
-  int*           consecints; // We need this as data for the hashes.
+			 // in the data; entry i of the map is for values[i].
+  int            minKey;  // lookup table, built once the map is read
+  int            keySpan; // (see compileDiscreteMap): dense[value -
+  int*           dense;   // minKey] is the entry for value, or -1. If
+  int*           sparseKeys;  // the values are too spread out, dense is
+  int*           sparseIndex; // NULL and an open-addressed hash of
+  int            sparseSize;  // sparseSize slots is used instead.
   HASHTABLE_T*   usedValues; // Which values are actually used -
 			     // needed to make the scale bar
 			     // correctly. This is a map of 'value' to a boolean, basically.
@@ -55,12 +56,18 @@ typedef struct matrixinfo_t  {
   char* fontName; // if supported
   DISCRETEMAP_T* discreteMap;
   USED_T* usedRegion;
+  LAYOUT_T* layout; /* the image as planned (see layoutMatrix), or NULL */
   BOOLEAN_T dividers;
   BOOLEAN_T circles;
   BOOLEAN_T rowLabelsLeft;
   BOOLEAN_T colLabelsBottom;
   BOOLEAN_T reverseJustification; // row label text alignment opposite of default?
+  BOOLEAN_T scaleHistogram; // draw a histogram of the values under the scale bar
+  BOOLEAN_T thinLabels; // label only the rows and columns the font has room for
+  BOOLEAN_T* rowLabelCandidates; /* if not NULL, the rows that may be labeled */
+  BOOLEAN_T* colLabelCandidates;
   MATRIX_T* matrix; /* pointer to the matrix itself */
+  MATRIXSTATS_T* stats; /* summary of the values in the matrix; NULL until known */
 } MATRIXINFO_T;
 
 
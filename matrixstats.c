@@ -0,0 +1,597 @@
+/*****************************************************************************
+ * FILE: matrixstats.c
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Summary statistics for a matrix gathered in a single
+ * pass: range, mean, missing value count, a value histogram and which
+ * integer values occur (for discrete maps). The reader fills one in as
+ * it parses, so that for untransformed data nothing has to look at
+ * the matrix again.
+ *****************************************************************************/
+#include "matrixstats.h"
+#include "array.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+
+/*****************************************************************************
+ * Create an empty statistics accumulator.
+ *****************************************************************************/
+MATRIXSTATS_T* new_matrix_stats
+  (void)
+{
+  MATRIXSTATS_T* stats = (MATRIXSTATS_T*)mycalloc(1, sizeof(MATRIXSTATS_T));
+
+  /* same starting point as the old range search, so an empty (or
+     all-missing) matrix comes out the same way. */
+  stats->min = (MTYPE)(FLT_MAX);
+  stats->max = -(MTYPE)(FLT_MAX);
+  stats->used = NULL;
+  stats->used_overflow = FALSE;
+  stats->trim_low = NULL;
+  stats->trim_high = NULL;
+  return(stats);
+}
+
+/*****************************************************************************
+ * Make the histogram cover a value by doubling the bin width
+ * (merging neighbouring bins) until it fits. Growing downwards also
+ * moves the start, so the old bins land in the upper half.
+ *****************************************************************************/
+static void extend_histogram
+  (double         value,
+   MATRIXSTATS_T* stats)
+{
+  int i_bin;
+  int half = STATS_NUM_BINS / 2;
+
+  while (value < stats->hist_start
+	 || value >= stats->hist_start + STATS_NUM_BINS * stats->hist_width) {
+    if (value < stats->hist_start) {
+      for (i_bin = STATS_NUM_BINS - 1; i_bin >= half; i_bin--) {
+	stats->hist[i_bin] = stats->hist[2 * (i_bin - half)]
+	  + stats->hist[2 * (i_bin - half) + 1];
+      }
+      for (i_bin = 0; i_bin < half; i_bin++) {
+	stats->hist[i_bin] = 0;
+      }
+      stats->hist_start -= STATS_NUM_BINS * stats->hist_width;
+    } else {
+      for (i_bin = 0; i_bin < half; i_bin++) {
+	stats->hist[i_bin] = stats->hist[2 * i_bin] + stats->hist[2 * i_bin + 1];
+      }
+      for (i_bin = half; i_bin < STATS_NUM_BINS; i_bin++) {
+	stats->hist[i_bin] = 0;
+      }
+    }
+    stats->hist_width *= 2.0;
+  }
+}
+
+static void add_to_histogram
+  (double         value,
+   MATRIXSTATS_T* stats)
+{
+  int i_bin;
+
+  if (stats->hist_width == 0.0) {
+    /* Everything so far has been the same value, which is sitting in
+       bin 0. Once something different comes along, spread the bins
+       over the two. */
+    if (stats->num_finite == 0 || value == stats->hist_start) {
+      stats->hist_start = value;
+      stats->hist[0]++;
+      return;
+    }
+    if (value < stats->hist_start) {
+      stats->hist_width = (stats->hist_start - value) / (STATS_NUM_BINS - 1);
+      stats->hist[STATS_NUM_BINS - 1] = stats->hist[0];
+      stats->hist[0] = 0;
+      stats->hist_start = value;
+    } else {
+      stats->hist_width = (value - stats->hist_start) / (STATS_NUM_BINS - 1);
+    }
+    if (stats->hist_width == 0.0) { /* underflow; hardly matters */
+      stats->hist_width = DBL_MIN;
+    }
+  }
+
+  extend_histogram(value, stats);
+  i_bin = (int)((value - stats->hist_start) / stats->hist_width);
+  if (i_bin >= STATS_NUM_BINS) { /* rounding */
+    i_bin = STATS_NUM_BINS - 1;
+  } else if (i_bin < 0) {
+    i_bin = 0;
+  }
+  stats->hist[i_bin]++;
+}
+
+/*****************************************************************************
+ * Note that an integer value occurs, growing the flags as needed.
+ *****************************************************************************/
+static void add_used_value
+  (double         value,
+   MATRIXSTATS_T* stats)
+{
+  int int_value;
+  int new_base;
+  int new_span;
+  unsigned char* new_used;
+
+  if (stats->used_overflow) {
+    return;
+  }
+  if (!(value > (double)INT_MIN && value < (double)INT_MAX)) {
+    stats->used_overflow = TRUE;
+    myfree(stats->used);
+    stats->used = NULL;
+    return;
+  }
+  int_value = (int)value;
+
+  if (stats->used == NULL) {
+    stats->used_base = int_value;
+    stats->used_span = 16;
+    stats->used = (unsigned char*)mycalloc(stats->used_span, sizeof(unsigned char));
+  } else if (int_value < stats->used_base
+	     || int_value >= stats->used_base + stats->used_span) {
+    /* At least double, so that a slowly widening range doesn't cost a
+       copy per value. */
+    new_base = stats->used_base;
+    new_span = stats->used_span * 2;
+    if (int_value < stats->used_base) {
+      if ((double)stats->used_base + stats->used_span - int_value > new_span) {
+	new_span = stats->used_base + stats->used_span - int_value;
+      }
+      new_base = stats->used_base + stats->used_span - new_span;
+    } else if ((double)int_value - stats->used_base + 1 > new_span) {
+      new_span = int_value - stats->used_base + 1;
+    }
+    if (new_span > STATS_MAX_USED_SPAN) {
+      stats->used_overflow = TRUE;
+      myfree(stats->used);
+      stats->used = NULL;
+      return;
+    }
+    new_used = (unsigned char*)mycalloc(new_span, sizeof(unsigned char));
+    memcpy(new_used + (stats->used_base - new_base), stats->used, stats->used_span);
+    myfree(stats->used);
+    stats->used = new_used;
+    stats->used_base = new_base;
+    stats->used_span = new_span;
+  }
+  stats->used[int_value - stats->used_base] = 1;
+}
+
+/*****************************************************************************
+ * Add one value (which may be missing) to the statistics.
+ *****************************************************************************/
+void add_stats_value
+  (MTYPE          value,
+   MATRIXSTATS_T* stats)
+{
+  if (isnan(value)) {
+    stats->num_missing++;
+    return;
+  }
+
+  stats->num_values++;
+  if (value < stats->min) {
+    stats->min = value;
+  }
+  if (value > stats->max) {
+    stats->max = value;
+  }
+  add_used_value(value, stats);
+
+  /* Infinities (e.g. the log of zero) count towards the range, as
+     before, but can't go in the histogram or the mean. */
+  if (isinf(value)) {
+    return;
+  }
+  add_to_histogram(value, stats);
+  stats->sum += value;
+  stats->num_finite++;
+}
+
+/*****************************************************************************
+ * Gather the statistics for a whole matrix, or for a raw array of row
+ * pointers.
+ *****************************************************************************/
+MATRIXSTATS_T* get_rawmatrix_stats
+  (MTYPE** matrix,
+   int     num_rows,
+   int     num_cols)
+{
+  MATRIXSTATS_T* stats = new_matrix_stats();
+  int i_row;
+  int i_col;
+
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      add_stats_value(matrix[i_row][i_col], stats);
+    }
+  }
+  return(stats);
+}
+
+MATRIXSTATS_T* get_matrix_stats
+  (MATRIX_T* matrix)
+{
+  MATRIXSTATS_T* stats = new_matrix_stats();
+  int num_cols = get_num_cols(matrix);
+  int i_row;
+  int i_col;
+  MTYPE* items;
+
+  for (i_row = 0; i_row < get_num_rows(matrix); i_row++) {
+    items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      add_stats_value(items[i_col], stats);
+    }
+  }
+  return(stats);
+}
+
+/*****************************************************************************
+ * Mean of the non-missing (and finite) values.
+ *****************************************************************************/
+double get_stats_mean
+  (MATRIXSTATS_T* stats)
+{
+  if (stats->num_finite == 0) {
+    return(NaN());
+  }
+  return(stats->sum / (double)stats->num_finite);
+}
+
+/*****************************************************************************
+ * Was this integer value seen?
+ *****************************************************************************/
+BOOLEAN_T stats_value_used
+  (int            value,
+   MATRIXSTATS_T* stats)
+{
+  if (stats->used == NULL
+      || value < stats->used_base
+      || value >= stats->used_base + stats->used_span) {
+    return(FALSE);
+  }
+  return(stats->used[value - stats->used_base]);
+}
+
+/*****************************************************************************
+ * Redistribute the histogram over num_bins equal bins covering [low,
+ * high]. Each source bin's count is shared out in proportion to its
+ * overlap with the new bins; whatever falls outside the range goes to
+ * the end bins, just as those values get the end colors. Returns the
+ * largest count.
+ *****************************************************************************/
+long rebin_stats_histogram
+  (double         low,
+   double         high,
+   int            num_bins,
+   long*          counts,
+   MATRIXSTATS_T* stats)
+{
+  double* shares;
+  double  width;
+  double  bin_low;
+  double  bin_high;
+  double  overlap_low;
+  double  overlap_high;
+  long    biggest = 0;
+  int     i_bin;
+  int     i_new;
+  int     first;
+  int     last;
+
+  myassert(TRUE, num_bins > 0, "Histogram needs at least one bin.\n");
+  shares = (double*)mycalloc(num_bins, sizeof(double));
+  width = (high - low) / num_bins;
+
+  for (i_bin = 0; i_bin < STATS_NUM_BINS; i_bin++) {
+    if (stats->hist[i_bin] == 0) {
+      continue;
+    }
+    bin_low = stats->hist_start + i_bin * stats->hist_width;
+    bin_high = bin_low + stats->hist_width;
+
+    if (width <= 0.0 || stats->hist_width == 0.0) {
+      /* degenerate: no spreading possible */
+      i_new = (width <= 0.0) ? 0 : (int)((bin_low - low) / width);
+      if (i_new < 0) i_new = 0;
+      if (i_new >= num_bins) i_new = num_bins - 1;
+      shares[i_new] += stats->hist[i_bin];
+      continue;
+    }
+
+    if (bin_low < low) {
+      shares[0] += stats->hist[i_bin]
+	* ((bin_high < low ? bin_high : low) - bin_low) / stats->hist_width;
+    }
+    if (bin_high > high) {
+      shares[num_bins - 1] += stats->hist[i_bin]
+	* (bin_high - (bin_low > high ? bin_low : high)) / stats->hist_width;
+    }
+    if (bin_high <= low || bin_low >= high) {
+      continue;
+    }
+
+    first = (int)((bin_low - low) / width);
+    last = (int)((bin_high - low) / width);
+    if (first < 0) first = 0;
+    if (last >= num_bins) last = num_bins - 1;
+    for (i_new = first; i_new <= last; i_new++) {
+      overlap_low = low + i_new * width;
+      overlap_high = overlap_low + width;
+      if (overlap_low < bin_low) overlap_low = bin_low;
+      if (overlap_high > bin_high) overlap_high = bin_high;
+      if (overlap_high > overlap_low) {
+	shares[i_new] += stats->hist[i_bin]
+	  * (overlap_high - overlap_low) / stats->hist_width;
+      }
+    }
+  }
+
+  for (i_new = 0; i_new < num_bins; i_new++) {
+    counts[i_new] = (long)(shares[i_new] + 0.5);
+    if (counts[i_new] > biggest) {
+      biggest = counts[i_new];
+    }
+  }
+  myfree(shares);
+  return(biggest);
+}
+
+/*****************************************************************************
+ * Find the range of values to map to colors: the smallest and largest
+ * values, or with outliers > 0, the values that percentage of the way
+ * in from either end (found by selection, not sorting).
+ *****************************************************************************/
+void find_stats_range
+  (MTYPE**        matrix,
+   int            num_rows,
+   int            num_cols,
+   double         outliers,
+   MATRIXSTATS_T* stats,
+   MTYPE*         min,
+   MTYPE*         max)
+{
+  int    i_row;
+  int    i_col;
+  long   num_present = 0;
+  int    index_dist;
+  MTYPE* present;
+
+  myassert(TRUE, outliers >= 0.0 && outliers <= 50.0, "Invalid outliers value %f", outliers);
+
+  if (!outliers) {
+    *min = stats->min;
+    *max = stats->max;
+    if (verbosity > NORMAL_VERBOSE)
+      fprintf(stderr, "Minimum value is %.2f; maximum values is %.2f\n", *min, *max);
+    return;
+  }
+
+  myassert(TRUE, stats->num_values > 0, "No data found!!");
+
+  /* Use the trim table if it has this percentage, and it rounds to
+     the same rank as the percentage asked for. */
+  if (stats->trim_low != NULL) {
+    int k = (int)floor(outliers * STATS_TRIMS_PER_PERCENT + 0.5);
+    if (fabs((double)k / STATS_TRIMS_PER_PERCENT - outliers) < 1e-9
+	&& ceil((double)stats->num_values * outliers / 100.0)
+	   == ceil((double)stats->num_values * ((double)k / STATS_TRIMS_PER_PERCENT) / 100.0)) {
+      *min = stats->trim_low[k];
+      *max = stats->trim_high[k];
+      if (verbosity > NORMAL_VERBOSE)
+	fprintf(stderr, "Minimum value is %.2f; maximum value is %.2f; trimming outliers below %.2f and above %.2f (from the trim table)\n", stats->min, stats->max, *min, *max);
+      return;
+    }
+  }
+
+  present = (MTYPE*)mymalloc(sizeof(MTYPE) * stats->num_values);
+  for (i_row = 0; i_row < num_rows; i_row++) {
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      if (isnan(matrix[i_row][i_col])) { // don't include NaN in computation of range.
+	continue;
+      }
+      present[num_present++] = matrix[i_row][i_col];
+    }
+  }
+  myassert(TRUE, num_present == stats->num_values,
+	   "Statistics are for %ld values but the matrix has %ld.\n",
+	   stats->num_values, num_present);
+
+  index_dist = (int)ceil(((double)num_present * outliers/100.0));
+  *min = select_kth_item(index_dist, num_present, present);
+  *max = select_kth_item(num_present - index_dist - 1, num_present, present);
+  if(verbosity > NORMAL_VERBOSE)
+    fprintf(stderr, "Minimum value is %.2f; maximum value is %.2f; trimming outliers below %.2f and above %.2f\n", stats->min, stats->max, *min, *max);
+  myfree(present);
+}
+
+/*****************************************************************************
+ * The trim table: sort the values once and read off the same ranks
+ * find_stats_range would select.
+ *****************************************************************************/
+static int value_compare
+  (const void* elem1,
+   const void* elem2)
+{
+  MTYPE num1 = *((MTYPE*)elem1);
+  MTYPE num2 = *((MTYPE*)elem2);
+
+  if (num1 < num2) {
+    return(-1);
+  } else if (num1 > num2) {
+    return(1);
+  }
+  return(0);
+}
+
+void compute_stats_trims
+  (MATRIX_T*      matrix,
+   MATRIXSTATS_T* stats)
+{
+  int    num_cols = get_num_cols(matrix);
+  int    i_row;
+  int    i_col;
+  int    k;
+  long   num_present = 0;
+  MTYPE* present;
+
+  if (stats->num_values == 0) {
+    return;
+  }
+  present = (MTYPE*)mymalloc(sizeof(MTYPE) * stats->num_values);
+  for (i_row = 0; i_row < get_num_rows(matrix); i_row++) {
+    MTYPE* items = raw_array(get_matrix_row(i_row, matrix));
+    for (i_col = 0; i_col < num_cols; i_col++) {
+      if (!isnan(items[i_col])) {
+	present[num_present++] = items[i_col];
+      }
+    }
+  }
+  myassert(TRUE, num_present == stats->num_values,
+	   "Statistics are for %ld values but the matrix has %ld.\n",
+	   stats->num_values, num_present);
+  qsort(present, num_present, sizeof(MTYPE), value_compare);
+
+  myfree(stats->trim_low);
+  myfree(stats->trim_high);
+  stats->trim_low = (MTYPE*)mymalloc(sizeof(MTYPE) * STATS_NUM_TRIMS);
+  stats->trim_high = (MTYPE*)mymalloc(sizeof(MTYPE) * STATS_NUM_TRIMS);
+  for (k = 0; k < STATS_NUM_TRIMS; k++) {
+    int index_dist = (int)ceil(((double)num_present * ((double)k / STATS_TRIMS_PER_PERCENT)/100.0));
+    if (index_dist > num_present - 1) index_dist = num_present - 1;
+    stats->trim_low[k] = present[index_dist];
+    stats->trim_high[k] = present[num_present - index_dist - 1];
+  }
+  myfree(present);
+}
+
+/*****************************************************************************
+ * The statistics file: one "name value..." line per item, with the
+ * trim table last. Values are written with enough digits to read
+ * back exactly.
+ *****************************************************************************/
+#define STATS_FILE_HEADER "# matrix2png statistics 1"
+
+void write_stats_file
+  (char*          filename,
+   char*          source,
+   int            num_rows,
+   int            num_cols,
+   MATRIXSTATS_T* stats)
+{
+  FILE* outfile;
+  int   k;
+
+  if (open_file(filename, "w", FALSE, "statistics", "the statistics", &outfile) == 0) {
+    return; /* not worth stopping for */
+  }
+  fprintf(outfile, "%s\n", STATS_FILE_HEADER);
+  fprintf(outfile, "source %s\n", source);
+  fprintf(outfile, "dimensions %d %d\n", num_rows, num_cols);
+  fprintf(outfile, "values %ld\n", stats->num_values);
+  fprintf(outfile, "missing %ld\n", stats->num_missing);
+  fprintf(outfile, "range %.17g %.17g\n", stats->min, stats->max);
+  if (stats->trim_low != NULL) {
+    for (k = 0; k < STATS_NUM_TRIMS; k++) {
+      fprintf(outfile, "trim %.1f %.17g %.17g\n", (double)k / STATS_TRIMS_PER_PERCENT,
+	      stats->trim_low[k], stats->trim_high[k]);
+    }
+  }
+  fclose(outfile);
+}
+
+BOOLEAN_T read_stats_file
+  (char*          filename,
+   char*          source,
+   int            num_rows,
+   int            num_cols,
+   MATRIXSTATS_T* stats)
+{
+  FILE*  infile;
+  char   line[1024];
+  int    rows = -1, cols = -1;
+  long   num_values = -1, num_missing = -1;
+  double min = 0.0, max = 0.0;
+  double percent, low, high;
+  int    num_trims = 0;
+  BOOLEAN_T same_source = FALSE;
+  MTYPE* trim_low;
+  MTYPE* trim_high;
+
+  if ((infile = fopen(filename, "r")) == NULL) {
+    return(FALSE);
+  }
+  if (fgets(line, sizeof(line), infile) == NULL
+      || strncmp(line, STATS_FILE_HEADER, strlen(STATS_FILE_HEADER)) != 0) {
+    fclose(infile);
+    return(FALSE);
+  }
+
+  trim_low = (MTYPE*)mymalloc(sizeof(MTYPE) * STATS_NUM_TRIMS);
+  trim_high = (MTYPE*)mymalloc(sizeof(MTYPE) * STATS_NUM_TRIMS);
+  while (fgets(line, sizeof(line), infile) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "source ", 7) == 0) {
+      same_source = (strcmp(line + 7, source) == 0);
+    } else if (strncmp(line, "trim ", 5) == 0) {
+      if (sscanf(line, "trim %lf %lf %lf", &percent, &low, &high) == 3
+	  && num_trims < STATS_NUM_TRIMS
+	  && fabs(percent - (double)num_trims / STATS_TRIMS_PER_PERCENT) < 1e-6) {
+	trim_low[num_trims] = low;
+	trim_high[num_trims] = high;
+	num_trims++;
+      }
+    } else {
+      /* each only matches its own name */
+      sscanf(line, "dimensions %d %d", &rows, &cols);
+      sscanf(line, "values %ld", &num_values);
+      sscanf(line, "missing %ld", &num_missing);
+      sscanf(line, "range %lf %lf", &min, &max);
+    }
+  }
+  fclose(infile);
+
+  /* Stale or for other data: the caller will make a new one. */
+  if (!same_source || rows != num_rows || cols != num_cols
+      || num_values != stats->num_values || num_missing != stats->num_missing
+      || min != stats->min || max != stats->max
+      || num_trims != STATS_NUM_TRIMS) {
+    myfree(trim_low);
+    myfree(trim_high);
+    return(FALSE);
+  }
+  myfree(stats->trim_low);
+  myfree(stats->trim_high);
+  stats->trim_low = trim_low;
+  stats->trim_high = trim_high;
+  return(TRUE);
+}
+
+/*****************************************************************************
+ * Free the statistics.
+ *****************************************************************************/
+void free_matrix_stats
+  (MATRIXSTATS_T* stats)
+{
+  if (stats == NULL) {
+    return;
+  }
+  myfree(stats->used);
+  myfree(stats->trim_low);
+  myfree(stats->trim_high);
+  myfree(stats);
+}
+
+/*
+ * matrixstats.c
+ */
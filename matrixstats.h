@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * FILE: matrixstats.h
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Summary statistics for a matrix gathered in a single
+ * pass, either while the data is being read or afterwards.
+ *****************************************************************************/
+#ifndef MATRIXSTATS_H
+#define MATRIXSTATS_H
+
+#include "utils.h"
+#include "matrix.h"
+
+/* Number of bins in the value histogram. The range the bins cover
+   grows (by doubling the bin width) as values arrive, so between half
+   and all of them end up spanning the data. */
+#define STATS_NUM_BINS 256
+
+/* Widest range of integer values we keep track of for discrete
+   maps. Beyond this the data clearly isn't discrete and we stop. */
+#define STATS_MAX_USED_SPAN 65536
+
+/* Trim bounds are kept for every tenth of a percent from 0 to 50,
+   when a statistics file provides them. */
+#define STATS_TRIMS_PER_PERCENT 10
+#define STATS_NUM_TRIMS 501
+
+typedef struct matrixstats_t {
+  long   num_values;  /* non-missing values seen */
+  long   num_missing;
+  long   num_finite;  /* non-missing and not infinite */
+  MTYPE  min;
+  MTYPE  max;
+  double sum;
+
+  /* histogram of the finite values: bin i holds
+     [hist_start + i*hist_width, hist_start + (i+1)*hist_width). The
+     width is zero until two different values have been seen. */
+  double hist_start;
+  double hist_width;
+  long   hist[STATS_NUM_BINS];
+
+  /* which integer values (as used for discrete maps: the value cast
+     to an int) occur, as flags over [used_base, used_base+used_span) */
+  int            used_base;
+  int            used_span;
+  unsigned char* used;
+  BOOLEAN_T      used_overflow; /* gave up: too wide a range */
+
+  /* trim_low[k] and trim_high[k] are the range find_stats_range gives
+     for trimming k/STATS_TRIMS_PER_PERCENT percent; NULL unless computed or
+     read from a statistics file. */
+  MTYPE*         trim_low;
+  MTYPE*         trim_high;
+} MATRIXSTATS_T;
+
+/***********************************************************************
+ * Create an empty statistics accumulator.
+ ***********************************************************************/
+MATRIXSTATS_T* new_matrix_stats
+  (void);
+
+/***********************************************************************
+ * Add one value (which may be missing) to the statistics.
+ ***********************************************************************/
+void add_stats_value
+  (MTYPE          value,
+   MATRIXSTATS_T* stats);
+
+/***********************************************************************
+ * Gather the statistics for a whole matrix, or for a raw array of
+ * row pointers.
+ ***********************************************************************/
+MATRIXSTATS_T* get_matrix_stats
+  (MATRIX_T* matrix);
+
+MATRIXSTATS_T* get_rawmatrix_stats
+  (MTYPE** matrix,
+   int     num_rows,
+   int     num_cols);
+
+/***********************************************************************
+ * Mean of the non-missing, finite values.
+ ***********************************************************************/
+double get_stats_mean
+  (MATRIXSTATS_T* stats);
+
+/***********************************************************************
+ * Was this integer value (value cast to int) seen? Only meaningful if
+ * used_overflow is FALSE.
+ ***********************************************************************/
+BOOLEAN_T stats_value_used
+  (int            value,
+   MATRIXSTATS_T* stats);
+
+/***********************************************************************
+ * Redistribute the histogram over num_bins equal bins covering
+ * [low, high]; values outside the range are counted in the end
+ * bins. Returns the largest count.
+ ***********************************************************************/
+long rebin_stats_histogram
+  (double         low,
+   double         high,
+   int            num_bins,
+   long*          counts,
+   MATRIXSTATS_T* stats);
+
+/***********************************************************************
+ * The range of values to map to colors: the data extremes, or with
+ * outliers > 0, trimmed by that percentage at each end.
+ ***********************************************************************/
+void find_stats_range
+  (MTYPE**        matrix,
+   int            num_rows,
+   int            num_cols,
+   double         outliers,
+   MATRIXSTATS_T* stats,
+   MTYPE*         min,
+   MTYPE*         max);
+
+/***********************************************************************
+ * Work out the trim table for the values in a matrix (by sorting
+ * them once).
+ ***********************************************************************/
+void compute_stats_trims
+  (MATRIX_T*      matrix,
+   MATRIXSTATS_T* stats);
+
+/***********************************************************************
+ * Save the statistics, with the trim table, to a small text file,
+ * or load the trim table back from one. source identifies the data
+ * the statistics describe (e.g. file name, size and time); reading
+ * fails, returning FALSE, unless it and the counts and range match.
+ ***********************************************************************/
+void write_stats_file
+  (char*          filename,
+   char*          source,
+   int            num_rows,
+   int            num_cols,
+   MATRIXSTATS_T* stats);
+
+BOOLEAN_T read_stats_file
+  (char*          filename,
+   char*          source,
+   int            num_rows,
+   int            num_cols,
+   MATRIXSTATS_T* stats);
+
+void free_matrix_stats
+  (MATRIXSTATS_T* stats);
+
+#endif /* MATRIXSTATS_H */
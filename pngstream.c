@@ -0,0 +1,441 @@
+/*****************************************************************************
+ * FILE: pngstream.c
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Write palette PNGs through libpng a few rows at a time,
+ * so an image never has to be held whole to be saved.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "pngstream.h"
+#include "utils.h"
+#include "gd.h"
+
+struct pngstream_t {
+  png_structp png;
+  png_infop   info;
+  int         width;
+  BOOLEAN_T   remap;    /* some palette entries are unused, so indices change */
+  png_byte    mapping[gdMaxColors];
+  png_bytep   remapped; /* one row, after remapping */
+
+  /* Large images are compressed here, in parallel, rather than by
+     libpng: the rows (filter byte and packed pixels) are gathered into
+     a batch of PNGCHUNKSIZE chunks, one per thread, which are deflated
+     at once and written as IDATs. */
+  BOOLEAN_T   parallel;
+  int         bitDepth;
+  size_t      rowBytes; /* packed, with the filter byte */
+  int         numChunks; /* per batch */
+  unsigned char* raw;   /* the last PNGDICTSIZE bytes of the previous
+			   batch, then this batch */
+  size_t      history;  /* how much of raw is the previous batch */
+  size_t      rawUsed;
+  BOOLEAN_T   started;  /* the zlib header has been written */
+  uLong       check;    /* adler32 of everything so far */
+  unsigned char* packed; /* the row being gathered, before filtering */
+  unsigned char* prior;  /* and the one before it */
+};
+
+/* set by setPngCompression */
+static int compressionLevel = PNGDEFAULTCOMPRESSION;
+static pngfilter_T rowFilter = default_filter;
+static pngstrategy_T zlibStrategy = default_strategy;
+
+
+/* libpng expects this not to return; die doesn't. */
+static void pngError(png_structp png, png_const_charp message)
+{
+  (void)png;
+  die("Could not write the PNG image: %s", message);
+} /* pngError */
+
+static void pngWarning(png_structp png, png_const_charp message)
+{
+  (void)png;
+  if (verbosity > NORMAL_VERBOSE)
+    fprintf(stderr, "Warning: %s\n", message);
+} /* pngWarning */
+
+
+/*****************************************************************************
+ * setPngCompression
+ *****************************************************************************/
+void setPngCompression(int level, pngfilter_T filter, pngstrategy_T strategy)
+{
+  if (level != PNGDEFAULTCOMPRESSION && (level < 0 || level > 9))
+    die("The PNG compression level must be from 0 to 9\n");
+  compressionLevel = level;
+  rowFilter = filter;
+  zlibStrategy = strategy;
+} /* setPngCompression */
+
+
+/* The zlib strategy to compress with: as set, or as libpng picks it
+   (filtered data for filtered rows). */
+static int chooseStrategy(void)
+{
+  switch (zlibStrategy) {
+  case filtered_strategy: return(Z_FILTERED);
+  case rle_strategy: return(Z_RLE);
+  case huffman_strategy: return(Z_HUFFMAN_ONLY);
+  default:
+    return(rowFilter == default_filter || rowFilter == none_filter ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+  }
+} /* chooseStrategy */
+
+
+/*****************************************************************************
+ * openPngStream
+ *****************************************************************************/
+PNGSTREAM_T* openPngStream(FILE* out, gdImagePtr palette, int width, int height)
+{
+  PNGSTREAM_T* stream;
+  png_color colors[gdMaxColors];
+  int numColors = 0;
+  int bitDepth;
+  int i;
+
+  if (width <= 0 || height <= 0) die("Can't write a %d by %d PNG image", width, height);
+
+  stream = (PNGSTREAM_T*)mycalloc(1, sizeof(PNGSTREAM_T));
+  stream->width = width;
+  stream->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, pngError, pngWarning);
+  if (stream->png == NULL) die("Could not start writing the PNG image");
+  stream->info = png_create_info_struct(stream->png);
+  if (stream->info == NULL) die("Could not start writing the PNG image");
+  png_init_io(stream->png, out);
+
+  /* leave out deallocated colors, as gd does, and use the fewest bits
+     per pixel that hold the rest */
+  for (i=0; i<gdImageColorsTotal(palette); i++) {
+    if (!palette->open[i]) {
+      stream->mapping[i] = (png_byte)numColors;
+      colors[numColors].red = (png_byte)gdImageRed(palette, i);
+      colors[numColors].green = (png_byte)gdImageGreen(palette, i);
+      colors[numColors].blue = (png_byte)gdImageBlue(palette, i);
+      numColors++;
+    }
+  }
+  if (numColors == 0) die("Can't write a PNG image without any colors");
+  if (numColors < gdImageColorsTotal(palette)) {
+    stream->remap = TRUE;
+    stream->remapped = (png_bytep)mymalloc(width);
+  }
+  if (numColors <= 2) bitDepth = 1;
+  else if (numColors <= 4) bitDepth = 2;
+  else if (numColors <= 16) bitDepth = 4;
+  else bitDepth = 8;
+
+  png_set_IHDR(stream->png, stream->info, width, height, bitDepth, PNG_COLOR_TYPE_PALETTE,
+	       PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_PLTE(stream->png, stream->info, colors, numColors);
+#ifdef GD_RESOLUTION
+  png_set_pHYs(stream->png, stream->info,
+	       (png_uint_32)(palette->res_x / 0.0254 + 0.5), (png_uint_32)(palette->res_y / 0.0254 + 0.5),
+	       PNG_RESOLUTION_METER);
+#endif
+  if (compressionLevel != PNGDEFAULTCOMPRESSION)
+    png_set_compression_level(stream->png, compressionLevel);
+  if (rowFilter != default_filter) {
+    png_set_filter(stream->png, PNG_FILTER_TYPE_BASE,
+		   rowFilter == none_filter ? PNG_FILTER_NONE :
+		   rowFilter == sub_filter ? PNG_FILTER_SUB :
+		   rowFilter == up_filter ? PNG_FILTER_UP : PNG_ALL_FILTERS);
+  }
+  if (zlibStrategy != default_strategy)
+    png_set_compression_strategy(stream->png, chooseStrategy());
+  png_write_info(stream->png, stream->info);
+  png_set_packing(stream->png);
+
+  /* Only worth it with several chunks to spread over the threads; small
+     images go through libpng, so they come out just as gd makes them. */
+  stream->bitDepth = bitDepth;
+  stream->rowBytes = ((size_t)width * bitDepth + 7) / 8 + 1;
+#ifdef _OPENMP
+  stream->numChunks = omp_get_max_threads();
+#else
+  stream->numChunks = 1;
+#endif
+  stream->parallel = stream->numChunks > 1 && stream->rowBytes * height >= 2 * PNGCHUNKSIZE;
+  if (stream->parallel) {
+    /* with room for a row over the batch, and a trial row after it */
+    stream->raw = (unsigned char*)mymalloc(PNGDICTSIZE + (size_t)stream->numChunks * PNGCHUNKSIZE + 2 * stream->rowBytes);
+    stream->check = adler32(0L, Z_NULL, 0);
+    stream->packed = (unsigned char*)mymalloc(stream->rowBytes);
+    stream->prior = (unsigned char*)mycalloc(stream->rowBytes, 1);
+    DEBUG_CODE(1, fprintf(stderr, "Compressing the PNG in %d chunks at a time\n", stream->numChunks););
+  }
+  return(stream);
+} /* openPngStream */
+
+
+/* Deflate one chunk of the batch, as raw deflate primed with the data
+   before it, ending on a byte boundary (or the end of the stream) so
+   the chunks can be joined. Returns the compressed data and sets its
+   length. */
+static unsigned char* deflateChunk(unsigned char* data, size_t length, size_t dictLength,
+				   BOOLEAN_T last, size_t* outLength)
+{
+  z_stream zs;
+  unsigned char* out;
+  size_t bound;
+
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, chooseStrategy()) != Z_OK)
+    die("Could not start compressing the PNG image");
+  if (dictLength > 0 && deflateSetDictionary(&zs, data - dictLength, (uInt)dictLength) != Z_OK)
+    die("Could not compress the PNG image");
+
+  /* room for a sync flush, and the final empty block, too */
+  bound = deflateBound(&zs, (uLong)length) + 16;
+  out = (unsigned char*)mymalloc(bound);
+  zs.next_in = data;
+  zs.avail_in = (uInt)length;
+  zs.next_out = out;
+  zs.avail_out = (uInt)bound;
+  if (deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH) != (last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0)
+    die("Could not compress the PNG image");
+  *outLength = bound - zs.avail_out;
+  deflateEnd(&zs);
+  return(out);
+} /* deflateChunk */
+
+
+/* Compress and write what has been gathered, in parallel, and keep
+   its end for the next batch's dictionary. */
+static void writeBatch(PNGSTREAM_T* stream, BOOLEAN_T last)
+{
+  unsigned char* data = stream->raw + stream->history;
+  size_t length = stream->rawUsed - stream->history;
+  int numChunks = (int)((length + PNGCHUNKSIZE - 1) / PNGCHUNKSIZE);
+  unsigned char** out;
+  size_t* outLength;
+  uLong* checks;
+  int i;
+
+  if (numChunks == 0) {
+    if (!last) return;
+    numChunks = 1; /* just the final block */
+  }
+  out = (unsigned char**)mymalloc(sizeof(unsigned char*) * numChunks);
+  outLength = (size_t*)mymalloc(sizeof(size_t) * numChunks);
+  checks = (uLong*)mymalloc(sizeof(uLong) * numChunks);
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i=0; i<numChunks; i++) {
+    size_t start = (size_t)i * PNGCHUNKSIZE;
+    size_t chunkLength = start + PNGCHUNKSIZE < length ? PNGCHUNKSIZE : length - start;
+    size_t dictLength = stream->history + start < PNGDICTSIZE ? stream->history + start : PNGDICTSIZE;
+    out[i] = deflateChunk(data + start, chunkLength, dictLength, last && i == numChunks - 1, &outLength[i]);
+    checks[i] = adler32(adler32(0L, Z_NULL, 0), data + start, (uInt)chunkLength);
+  }
+
+  /* the zlib header goes before the first chunk, and the check value
+     after the last */
+  if (!stream->started) {
+    png_byte header[2];
+    int strategy = chooseStrategy();
+    int level = compressionLevel == PNGDEFAULTCOMPRESSION ? 6 : compressionLevel;
+    /* the level is recorded as zlib does it, though nothing reads it */
+    int levelFlags = strategy == Z_HUFFMAN_ONLY || strategy == Z_RLE || level < 2 ? 0 :
+      level < 6 ? 1 : level == 6 ? 2 : 3;
+    header[0] = 0x78;
+    header[1] = (png_byte)(levelFlags << 6);
+    header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+    png_write_chunk(stream->png, (png_const_bytep)"IDAT", header, 2);
+    stream->started = TRUE;
+  }
+  for (i=0; i<numChunks; i++) {
+    size_t start = (size_t)i * PNGCHUNKSIZE;
+    size_t chunkLength = start + PNGCHUNKSIZE < length ? PNGCHUNKSIZE : length - start;
+    stream->check = adler32_combine(stream->check, checks[i], (z_off_t)chunkLength);
+    png_write_chunk(stream->png, (png_const_bytep)"IDAT", out[i], outLength[i]);
+    myfree(out[i]);
+  }
+  if (last) {
+    png_byte trailer[4];
+    png_save_uint_32(trailer, (png_uint_32)stream->check);
+    png_write_chunk(stream->png, (png_const_bytep)"IDAT", trailer, 4);
+  }
+
+  if (stream->rawUsed > PNGDICTSIZE) {
+    memmove(stream->raw, stream->raw + stream->rawUsed - PNGDICTSIZE, PNGDICTSIZE);
+    stream->rawUsed = PNGDICTSIZE;
+  }
+  stream->history = stream->rawUsed;
+  myfree(out);
+  myfree(outLength);
+  myfree(checks);
+} /* writeBatch */
+
+
+/* Paeth's predictor, from the PNG specification */
+static int paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return(a);
+  if (pb <= pc) return(b);
+  return(c);
+} /* paeth */
+
+
+/* Filter a packed row (after its filter byte) against the one before
+   with one of the five PNG filters, one byte per pixel as for any
+   palette image, writing the filter byte too. Returns the sum of the
+   filtered bytes taken as signed, which libpng's adaptive filtering
+   minimizes. */
+static unsigned long filterRow(int type, unsigned char* row, unsigned char* prior,
+			       size_t length, unsigned char* dest)
+{
+  unsigned long sum = 0;
+  size_t k;
+
+  dest[0] = (unsigned char)type;
+  for (k=1; k<length; k++) {
+    int left = k > 1 ? row[k - 1] : 0;
+    int upperLeft = k > 1 ? prior[k - 1] : 0;
+    unsigned char value;
+    switch (type) {
+    case PNG_FILTER_VALUE_SUB: value = (unsigned char)(row[k] - left); break;
+    case PNG_FILTER_VALUE_UP: value = (unsigned char)(row[k] - prior[k]); break;
+    case PNG_FILTER_VALUE_AVG: value = (unsigned char)(row[k] - (left + prior[k]) / 2); break;
+    case PNG_FILTER_VALUE_PAETH: value = (unsigned char)(row[k] - paeth(left, prior[k], upperLeft)); break;
+    default: value = row[k];
+    }
+    dest[k] = value;
+    sum += value < 128 ? value : 256 - value;
+  }
+  return(sum);
+} /* filterRow */
+
+
+/* Add a row to the batch, as PNG stores it: the filter type, then the
+   pixels packed to the bit depth, leftmost in the high bits, and
+   filtered. */
+static void gatherRow(PNGSTREAM_T* stream, unsigned char* row)
+{
+  unsigned char* dest = stream->raw + stream->rawUsed;
+  unsigned char* packed = stream->packed;
+  unsigned char* swap;
+  int x;
+
+  packed[0] = 0;
+  if (stream->bitDepth == 8) {
+    if (stream->remap) {
+      for (x=0; x<stream->width; x++) packed[x + 1] = stream->mapping[row[x]];
+    } else {
+      memcpy(packed + 1, row, stream->width);
+    }
+  } else {
+    int perByte = 8 / stream->bitDepth;
+    memset(packed + 1, 0, stream->rowBytes - 1);
+    for (x=0; x<stream->width; x++) {
+      int code = stream->remap ? stream->mapping[row[x]] : row[x];
+      packed[x / perByte + 1] |= code << (8 - stream->bitDepth * (x % perByte + 1));
+    }
+  }
+
+  switch (rowFilter) {
+  case sub_filter:
+    filterRow(PNG_FILTER_VALUE_SUB, packed, stream->prior, stream->rowBytes, dest);
+    break;
+  case up_filter:
+    filterRow(PNG_FILTER_VALUE_UP, packed, stream->prior, stream->rowBytes, dest);
+    break;
+  case adaptive_filter: {
+    /* try each, keeping the best in dest */
+    unsigned char* trial = dest + stream->rowBytes;
+    unsigned long best = filterRow(PNG_FILTER_VALUE_NONE, packed, stream->prior, stream->rowBytes, dest);
+    int type;
+    for (type = PNG_FILTER_VALUE_SUB; type <= PNG_FILTER_VALUE_PAETH && best > 0; type++) {
+      unsigned long sum = filterRow(type, packed, stream->prior, stream->rowBytes, trial);
+      if (sum < best) {
+	best = sum;
+	memcpy(dest, trial, stream->rowBytes);
+      }
+    }
+    break;
+  }
+  default:
+    memcpy(dest, packed, stream->rowBytes);
+  }
+  stream->rawUsed += stream->rowBytes;
+  swap = stream->prior;
+  stream->prior = stream->packed;
+  stream->packed = swap;
+
+  if (stream->rawUsed - stream->history >= (size_t)stream->numChunks * PNGCHUNKSIZE)
+    writeBatch(stream, FALSE);
+} /* gatherRow */
+
+
+/*****************************************************************************
+ * writePngRows
+ *****************************************************************************/
+void writePngRows(PNGSTREAM_T* stream, unsigned char** rows, int numRows)
+{
+  int i, x;
+
+  for (i=0; i<numRows; i++) {
+    if (stream->parallel) {
+      gatherRow(stream, rows[i]);
+    } else if (stream->remap) {
+      for (x=0; x<stream->width; x++) {
+	stream->remapped[x] = stream->mapping[rows[i][x]];
+      }
+      png_write_row(stream->png, stream->remapped);
+    } else {
+      png_write_row(stream->png, rows[i]);
+    }
+  }
+} /* writePngRows */
+
+
+/*****************************************************************************
+ * closePngStream
+ *****************************************************************************/
+void closePngStream(PNGSTREAM_T* stream)
+{
+  if (stream->parallel) {
+    /* libpng didn't see the IDATs, so it won't end the file itself */
+    writeBatch(stream, TRUE);
+    png_write_chunk(stream->png, (png_const_bytep)"IEND", NULL, 0);
+    png_write_flush(stream->png);
+  } else {
+    png_write_end(stream->png, stream->info);
+  }
+  png_destroy_write_struct(&stream->png, &stream->info);
+  myfree(stream->raw);
+  myfree(stream->packed);
+  myfree(stream->prior);
+  myfree(stream->remapped);
+  myfree(stream);
+} /* closePngStream */
+
+
+/*****************************************************************************
+ * writeImagePng
+ *****************************************************************************/
+void writeImagePng(gdImagePtr img, FILE* out)
+{
+  PNGSTREAM_T* stream;
+
+  stream = openPngStream(out, img, gdImageSX(img), gdImageSY(img));
+  writePngRows(stream, img->pixels, gdImageSY(img));
+  closePngStream(stream);
+} /* writeImagePng */
+
+/*
+ * pngstream.c
+ */
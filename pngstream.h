@@ -0,0 +1,77 @@
+/*****************************************************************************
+ * FILE: pngstream.h
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Write palette PNGs through libpng a few rows at a time,
+ * so an image never has to be held whole to be saved.
+ *****************************************************************************/
+#ifndef PNGSTREAM_H
+#define PNGSTREAM_H
+
+#include <stdio.h>
+#include "utils.h"
+#include "gd.h"
+
+/* Large images are deflated in chunks of this many bytes (of packed
+   rows), in parallel, each primed with the PNGDICTSIZE bytes before
+   it, the way pigz does. */
+#define PNGCHUNKSIZE (128 * 1024)
+#define PNGDICTSIZE (32 * 1024)
+
+/* the zlib level when none is set: its default (6), as gd uses */
+#define PNGDEFAULTCOMPRESSION -1
+
+/* How rows are filtered before compression. The default is libpng's
+   choice for palette images, which is no filtering; adaptive picks
+   whichever filter looks best for each row. */
+typedef enum {default_filter, none_filter, sub_filter, up_filter, adaptive_filter} pngfilter_T;
+
+/* The zlib strategy; by default, what libpng picks for the filter.
+   Run-length matching is quick but only finds runs along a row, not
+   the repeated rows of tall blocks. */
+typedef enum {default_strategy, filtered_strategy, rle_strategy, huffman_strategy} pngstrategy_T;
+
+typedef struct pngstream_t PNGSTREAM_T;
+
+/*****************************************************************************
+ * Set how every PNG written from now on is compressed: the zlib level
+ * (0, stored, to 9, or PNGDEFAULTCOMPRESSION), the row filter and the
+ * zlib strategy.
+ *****************************************************************************/
+void setPngCompression(int level,
+		       pngfilter_T filter,
+		       pngstrategy_T strategy);
+
+/*****************************************************************************
+ * Start a width x height PNG on out, with the colors of palette (a gd
+ * palette image, of any size, without transparency). The header and
+ * palette are written just as gdImagePng would write them for an
+ * image with those colors (and the default compression). Images of
+ * more than two chunks are compressed in parallel (if there are
+ * threads to do it), which decodes to the same pixels but isn't byte
+ * for byte what gd makes.
+ *****************************************************************************/
+PNGSTREAM_T* openPngStream(FILE* out,
+			   gdImagePtr palette,
+			   int width,
+			   int height);
+
+/*****************************************************************************
+ * Write the next numRows rows, each width palette indices.
+ *****************************************************************************/
+void writePngRows(PNGSTREAM_T* stream,
+		  unsigned char** rows,
+		  int numRows);
+
+/*****************************************************************************
+ * Finish the PNG once all the rows are written, and free the stream.
+ *****************************************************************************/
+void closePngStream(PNGSTREAM_T* stream);
+
+/*****************************************************************************
+ * Write a whole palette image, in place of gdImagePng.
+ *****************************************************************************/
+void writeImagePng(gdImagePtr img,
+		   FILE* out);
+
+#endif /* PNGSTREAM_H */
@@ -9,6 +9,7 @@
 #include "rdb-matrix.h"
 #include "string-list.h"
 #include "matrix.h"
+#include "matrixstats.h"
 #include "array.h"
 #include "utils.h"
 #include <string.h>
@@ -23,6 +24,7 @@ struct rdb_matrix_t {
   STRING_LIST_T* row_names;
   STRING_LIST_T* col_names;
   MATRIX_T*      matrix;
+  MATRIXSTATS_T* stats;         /* Gathered while reading, if at all. */
 };
 
 /***********************************************************************
@@ -48,6 +50,7 @@ RDB_MATRIX_T* allocate_rdb_matrix
   } else {
     return_value->matrix = matrix;
   }
+  return_value->stats = NULL;
 
   return(return_value);
 }
@@ -159,6 +162,45 @@ void set_raw_matrix
   }
   free_matrix(rdb_matrix->matrix);
   rdb_matrix->matrix = matrix;
+
+  /* The statistics were for the old matrix. */
+  free_matrix_stats(rdb_matrix->stats);
+  rdb_matrix->stats = NULL;
+}
+
+/***********************************************************************
+ * Statistics on the values in the matrix, collected as it was read.
+ * NULL if they weren't (or the matrix has since been replaced).
+ ***********************************************************************/
+MATRIXSTATS_T* get_rdb_stats
+  (RDB_MATRIX_T* rdb_matrix)
+{
+  if (rdb_matrix == NULL) {
+    die("Attempted to access null matrix.");
+  }
+  return(rdb_matrix->stats);
+}
+
+/***********************************************************************
+ * Transpose the matrix and swap the row and column names. The values
+ * are the same, so the statistics still apply.
+ ***********************************************************************/
+void transpose_rdb_matrix
+  (RDB_MATRIX_T* rdb_matrix)
+{
+  MATRIX_T*      transposed;
+  STRING_LIST_T* names;
+
+  if (rdb_matrix == NULL) {
+    die("Attempted to access null matrix.");
+  }
+  transposed = transpose_matrix(rdb_matrix->matrix);
+  free_matrix(rdb_matrix->matrix);
+  rdb_matrix->matrix = transposed;
+
+  names = rdb_matrix->row_names;
+  rdb_matrix->row_names = rdb_matrix->col_names;
+  rdb_matrix->col_names = names;
 }
 
 /***********************************************************************
@@ -472,7 +514,7 @@ RDB_MATRIX_T* read_rdb_matrix_wmissing
   RDB_MATRIX_T* return_value;   /* The RDB matrix being created. */
   int i_char;
   int this_char;
-  int num_missing = 0;
+  MATRIXSTATS_T* stats;         /* Summary of the values as we read them. */
   int length;
   int count = -1;
   int i_read = 0;
@@ -537,6 +579,7 @@ RDB_MATRIX_T* read_rdb_matrix_wmissing
 
   /* Allocate one row. */
   this_row = allocate_array(num_cols);
+  stats = new_matrix_stats();
 
   /* Skip the format line, if necessary. */
   if (format_line) {
@@ -623,7 +666,7 @@ RDB_MATRIX_T* read_rdb_matrix_wmissing
 		//		die("More data than column headings: Check data file format for correct header including 'corner string'.\nExpected %d columns, found at least %d", num_cols, i_read);
 	      } else {
 		set_array_item(i_read, NaN(), this_row);
-		num_missing++;
+		add_stats_value(NaN(), stats);
 		i_read++;
 	      }
 	    }
@@ -637,6 +680,7 @@ RDB_MATRIX_T* read_rdb_matrix_wmissing
 		die("Problem reading in row %d: Possible illegal character? Make sure the file is ASCII", i_row + 1);
 	      } else {
 		set_array_item(i_read, one_value, this_row);
+		add_stats_value(one_value, stats);
 		i_read++;
 	      }
 	    } else {
@@ -674,7 +718,7 @@ RDB_MATRIX_T* read_rdb_matrix_wmissing
     grow_matrix(this_row, matrix);
   }
   if (verbosity > NORMAL_VERBOSE) {
-    fprintf(stderr, "%d missing values\n", num_missing);
+    fprintf(stderr, "%ld missing values\n", stats->num_missing);
   }
 
   num_rows = get_num_strings(row_names);
@@ -694,6 +738,7 @@ RDB_MATRIX_T* read_rdb_matrix_wmissing
   set_corner_string(corner_string, return_value);
   set_row_names(row_names, return_value);
   set_col_names(col_names, return_value);
+  return_value->stats = stats;
 
   /* Free local dynamic memory. */
   myfree(corner_string);
@@ -788,6 +833,7 @@ void free_rdb_matrix
     free_string_list(rdb_matrix->row_names);
     free_string_list(rdb_matrix->col_names);
     free_matrix(rdb_matrix->matrix);
+    free_matrix_stats(rdb_matrix->stats);
 
     myfree(rdb_matrix);
   }
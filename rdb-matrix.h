@@ -11,6 +11,7 @@
 
 #include "string-list.h"
 #include "matrix.h"
+#include "matrixstats.h"
 #include "array.h"
 #include "utils.h"
 
@@ -61,6 +62,18 @@ void set_raw_matrix
   (MATRIX_T*     matrix,
    RDB_MATRIX_T* rdb_matrix);
 
+/***********************************************************************
+ * Statistics gathered while the matrix was read (NULL if none).
+ ***********************************************************************/
+MATRIXSTATS_T* get_rdb_stats
+  (RDB_MATRIX_T* rdb_matrix);
+
+/***********************************************************************
+ * Turn the matrix on its side: rows become columns, with the names.
+ ***********************************************************************/
+void transpose_rdb_matrix
+  (RDB_MATRIX_T* rdb_matrix);
+
 /***********************************************************************
  * Add a column name to a matrix.
  ***********************************************************************/
@@ -317,6 +317,30 @@ void sort_string_list
 	sizeof(char*), string_compare);
 }
 
+/*************************************************************************
+ * Reorder a list in place so that string i becomes the old string
+ * order[i]. The order must cover the whole list.
+ *************************************************************************/
+void permute_string_list
+  (int*           order,
+   STRING_LIST_T* a_list)
+{
+  char** new_strings;
+  int i_string;
+
+  check_null_list(a_list);
+
+  new_strings = (char**)mymalloc(sizeof(char*) * a_list->max_strings);
+  for (i_string = 0; i_string < a_list->num_strings; i_string++) {
+    new_strings[i_string] = a_list->strings[order[i_string]];
+  }
+  for (; i_string < a_list->max_strings; i_string++) {
+    new_strings[i_string] = a_list->strings[i_string];
+  }
+  myfree(a_list->strings);
+  a_list->strings = new_strings;
+}
+
 /***************************************************************************
  * Given two sets, A and B, find 
  *  - A intersect B,
@@ -104,6 +104,14 @@ STRING_LIST_T* copy_string_list
 void sort_string_list 
   (STRING_LIST_T* a_list);
 
+/*************************************************************************
+ * Reorder a list in place so that string i becomes the old string
+ * order[i].
+ *************************************************************************/
+void permute_string_list
+  (int*           order,
+   STRING_LIST_T* a_list);
+
 /***************************************************************************
  * Given two sets, A and B, find 
  *  - A union B,
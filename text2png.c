@@ -21,6 +21,7 @@
 #include "cmdline.h"
 #include "cmdparse.h"
 #include "colors.h"
+#include "ttfont.h"
 
 /*****************************************************************************
  * chooseFont - convert command line flag into font name (gdFontPtr)
@@ -44,6 +45,54 @@ gdFontPtr chooseFont (char* cmdlineflag)
 
 
 
+/* Width of a label in a TrueType font, with each run of DIVIDERCHARS
+   taking up DIVIDERWIDTH spaces, as stringlist2image draws it. */
+static int ttLabelWidth(TTFONT_T* ttfont, char* string)
+{
+  int width = 0;
+  int len;
+
+  string += strspn(string, DIVIDERCHARS);
+  while (*string != '\0') {
+    len = strcspn(string, DIVIDERCHARS);
+    width += ttStringWidth(ttfont, string, len);
+    string += len;
+    string += strspn(string, DIVIDERCHARS);
+    if (*string != '\0') width += DIVIDERWIDTH * ttStringWidth(ttfont, " ", 1);
+  }
+  return(width);
+} /* ttLabelWidth */
+
+
+/* Draw a label in a TrueType font with the pen starting at (x, y),
+   clipped to the lines (or columns, if vertical) from bandStart up to
+   bandEnd. */
+static void drawTTLabel(gdImagePtr img, TTFONT_T* ttfont, char* string, int x, int y,
+			unsigned char color, int bandStart, int bandEnd)
+{
+  int len, advance;
+  int divider = DIVIDERWIDTH * ttStringWidth(ttfont, " ", 1);
+
+  string += strspn(string, DIVIDERCHARS);
+  while (*string != '\0') {
+    len = strcspn(string, DIVIDERCHARS);
+    if (ttfont->vertical) {
+      ttDrawString(img, ttfont, string, len, x, y, color, bandStart, 0, bandEnd, img->sy);
+    } else {
+      ttDrawString(img, ttfont, string, len, x, y, color, 0, bandStart, img->sx, bandEnd);
+    }
+    advance = ttStringWidth(ttfont, string, len) + divider;
+    if (ttfont->vertical) {
+      y -= advance;
+    } else {
+      x += advance;
+    }
+    string += len;
+    string += strspn(string, DIVIDERCHARS);
+  }
+} /* drawTTLabel */
+
+
 /*****************************************************************************
  * calcTextDimensions - calculate the space needed for the text
  *****************************************************************************/
@@ -53,11 +102,13 @@ void calcTextDimensions (STRING_LIST_T* strings,
 			 int padding,
 			 int linespacing, /* extra linespacing */
 			 gdFontPtr font,
+			 TTFONT_T* ttfont,
 			 int *width,
 			 int *height)
 {
   int numstrings;
   int maxstring;
+  int i;
 
   maxstring = max_string_length(strings);  
   numstrings = get_num_strings(strings);
@@ -70,8 +121,18 @@ void calcTextDimensions (STRING_LIST_T* strings,
 
   /* calculate width and height of the image. If vertical, the
      gdImagedimensions are reversed from the usual */
-  *width = maxstring*font->w + 2*padding;
-  *height = numstrings*font->h + 2* padding + numstrings*linespacing;
+  if (ttfont != NULL) {
+    int maxwidth = 0;
+    for (i=0; i<numstrings; i++) {
+      int labelwidth = ttLabelWidth(ttfont, get_nth_string(i, strings));
+      if (labelwidth > maxwidth) maxwidth = labelwidth;
+    }
+    *width = maxwidth + 2*padding;
+    *height = numstrings*ttfont->height + 2* padding + numstrings*linespacing;
+  } else {
+    *width = maxstring*font->w + 2*padding;
+    *height = numstrings*font->h + 2* padding + numstrings*linespacing;
+  }
 
   if (*width > WARNINGSIZE || *height > WARNINGSIZE) {
     if (verbosity >= NORMAL_VERBOSE)
@@ -91,25 +152,142 @@ void calcTextDimensions (STRING_LIST_T* strings,
 } /*calcTextDimensions */
 
 
+/******************************************************************************
+ * The glyph atlas: every character of a gd bitmap font rasterized once,
+ * upright or turned for gdImageStringUp, as byte masks (0xff where the
+ * glyph is set) that can be merged straight into the image rows.
+ *****************************************************************************/
+typedef struct glyphatlas_t {
+  gdFontPtr font;
+  BOOLEAN_T vertical;
+  int glyphWidth;   /* as drawn: font->w wide, or font->h when turned */
+  int glyphHeight;
+  unsigned char* masks; /* glyphHeight rows of glyphWidth bytes per character */
+} GLYPHATLAS_T;
+
+static void initGlyphAtlas(GLYPHATLAS_T* atlas, gdFontPtr font, BOOLEAN_T vertical)
+{
+  int c, r, k;
+  size_t glyphSize;
+
+  atlas->font = font;
+  atlas->vertical = vertical;
+  if (vertical) {
+    atlas->glyphWidth = font->h;
+    atlas->glyphHeight = font->w;
+  } else {
+    atlas->glyphWidth = font->w;
+    atlas->glyphHeight = font->h;
+  }
+  glyphSize = (size_t)font->w * font->h;
+  atlas->masks = (unsigned char*)mymalloc(glyphSize * font->nchars);
+
+  for (c=0; c<font->nchars; c++) {
+    char* glyph = font->data + c*glyphSize;
+    unsigned char* mask = atlas->masks + c*glyphSize;
+    for (r=0; r<atlas->glyphHeight; r++) {
+      for (k=0; k<atlas->glyphWidth; k++) {
+	/* turned glyphs go up the page: the first font column ends up
+	   as the bottom row, as gdImageCharUp draws them */
+	int set = vertical ? glyph[k*font->w + font->w - 1 - r] : glyph[r*font->w + k];
+	mask[r*atlas->glyphWidth + k] = set ? 0xff : 0;
+      }
+    }
+  }
+} /* initGlyphAtlas */
+
+
+/*****************************************************************************
+ * blitMask
+ *****************************************************************************/
+void blitMask(gdImagePtr img, unsigned char* mask, int width, int height,
+	      int x, int y, unsigned char color)
+{
+  blitMaskClipped(img, mask, width, height, x, y, color, 0, 0, img->sx, img->sy);
+} /* blitMask */
+
+
+/*****************************************************************************
+ * blitMaskClipped
+ *****************************************************************************/
+void blitMaskClipped(gdImagePtr img, unsigned char* mask, int width, int height,
+		     int x, int y, unsigned char color,
+		     int clipX1, int clipY1, int clipX2, int clipY2)
+{
+  int firstCol, lastCol, firstRow, lastRow, row, col;
+
+  if (clipX1 < 0) clipX1 = 0;
+  if (clipY1 < 0) clipY1 = 0;
+  if (clipX2 > img->sx) clipX2 = img->sx;
+  if (clipY2 > img->sy) clipY2 = img->sy;
+  firstCol = x < clipX1 ? clipX1 : x;
+  lastCol = x + width > clipX2 ? clipX2 : x + width;
+  firstRow = y < clipY1 ? clipY1 : y;
+  lastRow = y + height > clipY2 ? clipY2 : y + height;
+
+  for (row=firstRow; row<lastRow; row++) {
+    unsigned char* src = mask + (row - y)*width - x;
+    unsigned char* dst = img->pixels[row];
+    for (col=firstCol; col<lastCol; col++) {
+      dst[col] = (unsigned char)((dst[col] & ~src[col]) | (color & src[col]));
+    }
+  }
+} /* blitMaskClipped */
+
+
+/* Copy one character into the image with its top left corner at
+   (x, y). Characters the font doesn't have are left blank, as gd
+   does. */
+static void blitGlyph(gdImagePtr img, GLYPHATLAS_T* atlas, unsigned char c, int x, int y, unsigned char color)
+{
+  size_t glyphSize = (size_t)atlas->glyphWidth * atlas->glyphHeight;
+
+  if (c < atlas->font->offset || c >= atlas->font->offset + atlas->font->nchars) return;
+  blitMask(img, atlas->masks + (c - atlas->font->offset)*glyphSize, atlas->glyphWidth, atlas->glyphHeight, x, y, color);
+} /* blitGlyph */
+
+
+/* Draw len characters of a string from (x, y), placed exactly as
+   gdImageString (or gdImageStringUp, for a turned atlas) would. */
+static void blitString(gdImagePtr img, GLYPHATLAS_T* atlas, char* string, int len, int x, int y, unsigned char color)
+{
+  int k;
+  if (atlas->vertical) {
+    y -= atlas->glyphHeight - 1;
+    for (k=0; k<len; k++) {
+      blitGlyph(img, atlas, (unsigned char)string[k], x, y, color);
+      y -= atlas->glyphHeight;
+    }
+  } else {
+    for (k=0; k<len; k++) {
+      blitGlyph(img, atlas, (unsigned char)string[k], x, y, color);
+      x += atlas->glyphWidth;
+    }
+  }
+} /* blitString */
+
+
 /******************************************************************************
  * stringlist2image - takes a string list structure							      
  *****************************************************************************/
 void stringlist2image (gdImagePtr img,
 		       STRING_LIST_T* strings,
 		       int numtodo,
+		       BOOLEAN_T* shown,
 		       BOOLEAN_T rightJustify,
 		       BOOLEAN_T vertical,		       
 		       int padding, /* extra pixels at start of text */
 		       int linespacing,
 		       int initX,
 		       int initY,
-		       gdFontPtr font)
+		       gdFontPtr font,
+		       TTFONT_T* ttfont)
 {
   int numstrings;
   int i;
-  char* string;
   int backgroundColor, textColor, maxString, len;
-  int width, height;
+  int width, height, textLength;
+  GLYPHATLAS_T atlas;
 
   numstrings = get_num_strings(strings);
   if (numstrings < numtodo) {
@@ -119,7 +297,8 @@ void stringlist2image (gdImagePtr img,
   }
 
   /* this is already done in some situations */
-  calcTextDimensions(strings, numtodo, vertical, padding, linespacing, font, &width, &height);
+  calcTextDimensions(strings, numtodo, vertical, padding, linespacing, font, ttfont, &width, &height);
+  textLength = (vertical ? height : width) - 2*padding;
   
   /* allocate image and colors if image is null; otherwise add to existing image */
   if (img == NULL) {
@@ -142,7 +321,7 @@ void stringlist2image (gdImagePtr img,
 
   /* prepare for padding; get the longest string length. We do this instead of max_string_length as that isn't accurate */
   maxString = 0;
-  if (rightJustify) {
+  if (rightJustify && ttfont == NULL) {
     for(i=0; i<numstrings; i++) {
       len = strlen(get_nth_string(i, strings));
       if (len > maxString) {
@@ -151,58 +330,80 @@ void stringlist2image (gdImagePtr img,
     }
   }
 
-  /* draw the text. All the tokenizing business is because the gd
-     fonts don't render tabs as blanks */
+  atlas.masks = NULL;
+  if (ttfont == NULL) {
+    initGlyphAtlas(&atlas, font, vertical);
+  }
+
+  /* draw the text. The gd fonts don't render tabs as blanks, so each
+     run of DIVIDERCHARS becomes DIVIDERWIDTH blank characters. Right
+     justified words are shifted over by the blanks they would have
+     been padded with. Each string has its own lines of the image (or
+     columns, if vertical), so they can be drawn in parallel; thinned
+     out strings may be closer together than the font is high, but
+     only those far enough apart are shown. */
+#pragma omp parallel for private(len) schedule(static) if (linespacing >= 0 || shown != NULL)
   for (i=0; i< numstrings; i++) {
     char *word;
     int currentpos;
+    if (shown != NULL && !shown[i]) {
+      continue;
+    }
+
+    /* TrueType labels are justified as a whole, by their width in
+       pixels. Glyphs can reach past the line (accented capitals, say),
+       so each label is clipped to its own band: its pitch, or the line
+       height if thinned lines are closer than that (the labels shown
+       are then at least a line apart). */
+    if (ttfont != NULL) {
+      int shift = 0;
+      int pitch = linespacing + ttfont->height;
+      int bandStart = (vertical ? initX : initY) + i*pitch;
+      int bandEnd = bandStart + (pitch > ttfont->height ? pitch : ttfont->height);
+      word = get_nth_string(i, strings);
+      if (rightJustify) {
+	shift = textLength - ttLabelWidth(ttfont, word);
+      }
+      if (vertical) {
+	drawTTLabel(img, ttfont, word, bandStart + ttfont->ascent, initY + height - padding - shift,
+		    (unsigned char)textColor, bandStart, bandEnd);
+      } else {
+	drawTTLabel(img, ttfont, word, initX + padding + shift, bandStart + ttfont->ascent,
+		    (unsigned char)textColor, bandStart, bandEnd);
+      }
+      continue;
+    }
+
     if (vertical) {
       currentpos = initY;
     } else {
       currentpos = initX;
     }
-    string = get_nth_string(i, strings);
-    word = strtok(string, DIVIDERCHARS);
-    while (word != NULL) {
-
-      if (rightJustify) {
-	len = strlen(word);
-	if (len < maxString) {
-	    word = leftPadString(word, maxString - len);
-	}
+    word = get_nth_string(i, strings);
+    word += strspn(word, DIVIDERCHARS);
+    while (*word != '\0') {
+      int padChars = 0;
+
+      len = strcspn(word, DIVIDERCHARS);
+      if (rightJustify && len < maxString) {
+	padChars = maxString - len;
       }
 
       if (vertical) {
-	gdImageStringUp(img, font, initX + i*(linespacing + font->h), currentpos + height - padding, (unsigned char*)word, textColor);
-	currentpos += (strlen(word)+DIVIDERWIDTH) * font->h;
+	blitString(img, &atlas, word, len, initX + i*(linespacing + font->h), currentpos + height - padding - padChars*font->w, (unsigned char)textColor);
+	currentpos += (padChars + len + DIVIDERWIDTH) * font->h;
       } else {
-	gdImageString(img, font, currentpos + padding, initY + i*(linespacing + font->h), (unsigned char*)word, textColor);
-	currentpos += (strlen(word)+DIVIDERWIDTH) * font->w;
+	blitString(img, &atlas, word, len, currentpos + padding + padChars*font->w, initY + i*(linespacing + font->h), (unsigned char)textColor);
+	currentpos += (padChars + len + DIVIDERWIDTH) * font->w;
       }
-      word = strtok(NULL, DIVIDERCHARS);
+      word += len;
+      word += strspn(word, DIVIDERCHARS);
     }
   }
 
+  myfree(atlas.masks);
 } /* stringlist2image */
 
-char* leftPadString(char* string, size_t paddingSize){
-  size_t lenstring = strlen(string);
-  char* padded = (char*)malloc(lenstring + paddingSize + 1);
-  size_t i;
-  
-  if (paddingSize == 0) {
-    return string;
-  }
-
-  for(i = 0; i < paddingSize; i++) {
-    padded[i] = ' ';
-  }
-
-  strcpy(&(padded[i]), string);
-  /*  DEBUG_CODE(1, fprintf(stderr, "%d %s\n", (int)paddingSize, padded););*/
-  return padded;
-}
-
 
 /*
  * main
@@ -261,7 +462,7 @@ int main (int argc, char **argv) {
   /* write the image from the string list */
   initX = 20;
   initY = 110;
-  stringlist2image(img, stringlist, rightJustify, vertical, padding, linespacing, initX, initY, font);
+  stringlist2image(img, stringlist, NULL, rightJustify, vertical, padding, linespacing, initX, initY, font, NULL);
   if (img != NULL) {
     pngout = fopen("testfromstringlist.png", "wb");
     gdImagePng(img, pngout);
@@ -12,6 +12,7 @@
 #include "gd.h"
 #include "utils.h"
 #include "matrix2png.h"
+#include "ttfont.h"
 
 #define WARNINGSIZE 40000 /* images larger than this many pixels
                              (wide,high) may not display properly in
@@ -32,6 +33,7 @@ void calcTextDimensions (STRING_LIST_T* strings,
 			 int padding,
 			 int linespacing,
 			 gdFontPtr font,
+			 TTFONT_T* ttfont, /* used instead of font if not NULL */
 			 int *width,
 			 int *height);
 
@@ -42,24 +44,52 @@ void calcTextDimensions (STRING_LIST_T* strings,
 void stringlist2image (gdImagePtr img,
 		       STRING_LIST_T* strings,
 		       int numtodo,
+		       BOOLEAN_T* shown, /* which strings to draw, or NULL for all of them */
 		       BOOLEAN_T rightJustified, /* this means top justified if vertical is true */
 		       BOOLEAN_T vertical,
 		       int padding, /* extra pixels at edge of image */
 		       int linespacing,
 		       int initX,
 		       int initY,
-		       gdFontPtr font /* 0,1,2,3,4 for tiny, small, medium, large, giant */
+		       gdFontPtr font, /* 0,1,2,3,4 for tiny, small, medium, large, giant */
+		       TTFONT_T* ttfont /* used instead of font if not NULL */
 		       );
 
+/*****************************************************************************
+ * blitMask - set the pixels of the image under a mask (0xff where set,
+ * 0 elsewhere) of width x height with its top left corner at x, y,
+ * clipped to the image.
+ *****************************************************************************/
+void blitMask(gdImagePtr img,
+	      unsigned char* mask,
+	      int width,
+	      int height,
+	      int x,
+	      int y,
+	      unsigned char color);
+
+/*****************************************************************************
+ * blitMaskClipped - the same, clipped to the rectangle from (clipX1,
+ * clipY1) up to but not including (clipX2, clipY2) as well.
+ *****************************************************************************/
+void blitMaskClipped(gdImagePtr img,
+		     unsigned char* mask,
+		     int width,
+		     int height,
+		     int x,
+		     int y,
+		     unsigned char color,
+		     int clipX1,
+		     int clipY1,
+		     int clipX2,
+		     int clipY2);
+
 
 /*****************************************************************************
  * chooseFont - convert command line flag into font name
  *****************************************************************************/
 gdFontPtr chooseFont (char* cmdlineflag);
 
-/* Add spaces to the beginning of a string */
-char* leftPadString(char* string, size_t paddingSize);
-
 #endif /*TEXT2IMAGE_H*/
 
 
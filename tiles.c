@@ -0,0 +1,169 @@
+/*****************************************************************************
+ * FILE: tiles.c
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Write a matrix as a Deep Zoom tile pyramid, so that a
+ * web viewer can pan and zoom over a matrix far too big for a single
+ * image. Each level is made from the one above it by halving, and the
+ * tiles of a level are drawn and encoded in parallel.
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "tiles.h"
+#include "matrix.h"
+#include "utils.h"
+#include "gd.h"
+#include "pngstream.h"
+
+/* Make a directory unless it is already there. */
+static void makeDirectory(char* path) {
+  if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+    die("Could not create directory %s: %s\n", path, strerror(errno));
+  }
+} /* makeDirectory */
+
+/* Draw and write one tile of a level: the values in rows
+   [firstRow, firstRow + height) and columns [firstCol, firstCol +
+   width), one pixel each. */
+static void writeTile (
+		     char* fileName,
+		     MATRIX_T* level,
+		     int firstRow,
+		     int firstCol,
+		     int width,
+		     int height,
+		     double stepsize,
+		     BOOLEAN_T clip,
+		     BOOLEAN_T passThroughBlack,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* backgroundColor,
+		     colorV_T* missingColor,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  gdImagePtr tile;
+  FILE* out;
+  int y;
+  int numColorsTotal;
+
+  tile = gdImageCreate(width, height);
+  allocateImageColors(tile, backgroundColor, minColor, midColor, maxColor, missingColor, passThroughBlack, colorMap, matrixInfo);
+  numColorsTotal = gdImageColorsTotal(tile);
+
+  /* one pixel per value, so each row maps straight into the tile */
+  for (y = 0; y < height; y++) {
+    MTYPE* items = raw_array(get_matrix_row(firstRow + y, level)) + firstCol;
+    mapValuesToColors(items, width, matrixInfo->minval, matrixInfo->maxval, stepsize, clip, numColorsTotal, matrixInfo, tile->pixels[y]);
+  }
+
+  if ((out = fopen(fileName, "wb")) == NULL) {
+    die("Could not write tile %s\n", fileName);
+  }
+  writeImagePng(tile, out);
+  fclose(out);
+  gdImageDestroy(tile);
+} /* writeTile */
+
+/* Write the Deep Zoom pyramid for a matrix. */
+void writeTilePyramid (
+		     char* dirName,
+		     MATRIX_T* matrix,
+		     binmode_T binMode,
+		     BOOLEAN_T clip,
+		     BOOLEAN_T passThroughBlack,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* backgroundColor,
+		     colorV_T* missingColor,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     )
+{
+  MATRIX_T* level = matrix;
+  int numLevels;
+  int levelNum;
+  int largest;
+  double range, stepsize;
+  size_t pathLength = strlen(dirName) + strlen(TILEBASENAME) + 64;
+  char* path = (char*)mymalloc(pathLength);
+  FILE* descriptor;
+
+  /* only the rows and columns drawn in the image (-numr, -numc) */
+  if (matrixInfo->rowsToUse < get_num_rows(matrix) || matrixInfo->colsToUse < get_num_cols(matrix)) {
+    level = crop_matrix(matrixInfo->rowsToUse, matrixInfo->colsToUse, matrix);
+  }
+
+  /* Deep Zoom counts levels up from a single pixel. */
+  largest = get_num_rows(level) > get_num_cols(level) ? get_num_rows(level) : get_num_cols(level);
+  for (numLevels = 1; (1 << (numLevels - 1)) < largest; numLevels++);
+
+  /* same mapping as the full image */
+  range = matrixInfo->maxval - matrixInfo->minval;
+  if (range == 0.0) range = 1;
+  stepsize = range / matrixInfo->numColors;
+
+  makeDirectory(dirName);
+  sprintf(path, "%s/%s.dzi", dirName, TILEBASENAME);
+  if (open_file(path, "w", FALSE, "tile descriptor", "the tile descriptor", &descriptor) == 0) exit(1);
+  fprintf(descriptor, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  fprintf(descriptor, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n", TILESIZE);
+  fprintf(descriptor, "  <Size Width=\"%d\" Height=\"%d\"/>\n</Image>\n", get_num_cols(level), get_num_rows(level));
+  fclose(descriptor);
+  sprintf(path, "%s/%s_files", dirName, TILEBASENAME);
+  makeDirectory(path);
+
+  for (levelNum = numLevels - 1; levelNum >= 0; levelNum--) {
+    int numRows = get_num_rows(level);
+    int numCols = get_num_cols(level);
+    int tileRows = (numRows + TILESIZE - 1) / TILESIZE;
+    int tileCols = (numCols + TILESIZE - 1) / TILESIZE;
+    int numTiles = tileRows * tileCols;
+    int i_tile;
+
+    DEBUG_CODE(1, fprintf(stderr, "Tile level %d: %d by %d, %d tiles\n", levelNum, numRows, numCols, numTiles););
+    sprintf(path, "%s/%s_files/%d", dirName, TILEBASENAME, levelNum);
+    makeDirectory(path);
+
+#pragma omp parallel for schedule(dynamic)
+    for (i_tile = 0; i_tile < numTiles; i_tile++) {
+      int tileRow = i_tile / tileCols;
+      int tileCol = i_tile % tileCols;
+      int firstRow = tileRow * TILESIZE;
+      int firstCol = tileCol * TILESIZE;
+      char* fileName = (char*)mymalloc(pathLength);
+
+      sprintf(fileName, "%s/%s_files/%d/%d_%d.png", dirName, TILEBASENAME, levelNum, tileCol, tileRow);
+      writeTile(fileName, level, firstRow, firstCol,
+		(firstCol + TILESIZE < numCols ? TILESIZE : numCols - firstCol),
+		(firstRow + TILESIZE < numRows ? TILESIZE : numRows - firstRow),
+		stepsize, clip, passThroughBlack,
+		minColor, midColor, maxColor, backgroundColor, missingColor,
+		colorMap, matrixInfo);
+      myfree(fileName);
+    }
+
+    /* the next level down; keep only the one being drawn */
+    if (levelNum > 0) {
+      MATRIX_T* below = halve_matrix(binMode, level);
+      if (level != matrix) {
+	free_matrix(level);
+      }
+      level = below;
+    }
+  }
+  if (level != matrix) {
+    free_matrix(level);
+  }
+  myfree(path);
+} /* writeTilePyramid */
+
+/*
+ * tiles.c
+ */
@@ -0,0 +1,39 @@
+/*****************************************************************************
+ * FILE: tiles.h
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: Write a matrix as a pyramid of image tiles for zooming
+ * viewers.
+ *****************************************************************************/
+#ifndef TILES_H
+#define TILES_H
+
+#include "matrix2png.h"
+
+#define TILESIZE 256     /* pixels along each side of a tile */
+#define TILEBASENAME "matrix"
+
+/* Write the matrix as a Deep Zoom image in dirName: a descriptor,
+   dirName/matrix.dzi, and tiles dirName/matrix_files/LEVEL/COL_ROW.png.
+   Only the first matrixInfo->rowsToUse rows and colsToUse columns
+   are used, as in the image. The top level has one pixel per value;
+   each level below halves the one above, combining values with
+   binMode. Colors are as in the
+   image made by rawmatrix2img, which must have been called first to
+   fix the range (matrixInfo->minval, maxval). */
+void writeTilePyramid (
+		     char* dirName,
+		     MATRIX_T* matrix,
+		     binmode_T binMode,
+		     BOOLEAN_T clip, /* clamp values outside the range, as rawmatrix2img did */
+		     BOOLEAN_T passThroughBlack,
+		     colorV_T* minColor,
+		     colorV_T* midColor,
+		     colorV_T* maxColor,
+		     colorV_T* backgroundColor,
+		     colorV_T* missingColor,
+		     int colorMap,
+		     MATRIXINFO_T* matrixInfo
+		     );
+
+#endif /* TILES_H */
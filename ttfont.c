@@ -0,0 +1,310 @@
+/*****************************************************************************
+ * FILE: ttfont.c
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: TrueType (or any FreeType-readable) fonts for labels,
+ * with the glyphs cached per font, size and rotation.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ttfont.h"
+#include "text2png.h"
+#include "utils.h"
+#include "gd.h"
+
+#ifdef USE_FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* The fonts asked for so far, each opened once; face is NULL for
+   names that couldn't be loaded, so we only complain once. */
+typedef struct ttface_t {
+  char*   name;
+  FT_Face face;
+} TTFACE_T;
+
+static FT_Library library = NULL;
+static TTFACE_T faces[MAXTTFONTS];
+static int numFaces = 0;
+#endif
+
+/* every font, size and rotation rendered so far */
+static TTFONT_T* fonts[MAXTTFONTS];
+static int numFonts = 0;
+
+
+#ifdef USE_FREETYPE
+/* Open a font by file name, or failing that look for it (with or
+   without a .ttf extension) in each directory along GDFONTPATH, the
+   way gd does. */
+static FT_Face openFace(char* fontName)
+{
+  FT_Face face;
+  char* path;
+  char* dirs;
+  char* dir;
+  char* file;
+
+  if (FT_New_Face(library, fontName, 0, &face) == 0)
+    return(face);
+
+  path = getenv("GDFONTPATH");
+  if (path == NULL) path = TTFONT_DEFAULT_PATH;
+  dirs = (char*)mymalloc(strlen(path) + 1);
+  strcpy(dirs, path);
+  file = (char*)mymalloc(strlen(path) + strlen(fontName) + 6);
+
+  face = NULL;
+  for (dir = strtok(dirs, ":"); dir != NULL && face == NULL; dir = strtok(NULL, ":")) {
+    sprintf(file, "%s/%s", dir, fontName);
+    if (FT_New_Face(library, file, 0, &face) == 0) break;
+    sprintf(file, "%s/%s.ttf", dir, fontName);
+    if (FT_New_Face(library, file, 0, &face) == 0) break;
+    face = NULL;
+  }
+  myfree(dirs);
+  myfree(file);
+  return(face);
+} /* openFace */
+
+
+static FT_Face findFace(char* fontName)
+{
+  int i;
+
+  for (i=0; i<numFaces; i++) {
+    if (strcmp(faces[i].name, fontName) == 0)
+      return(faces[i].face);
+  }
+
+  if (library == NULL && FT_Init_FreeType(&library) != 0) {
+    die("Could not start FreeType");
+  }
+  if (numFaces == MAXTTFONTS) die("Too many fonts (at most %d)", MAXTTFONTS);
+  faces[numFaces].name = (char*)mymalloc(strlen(fontName) + 1);
+  strcpy(faces[numFaces].name, fontName);
+  faces[numFaces].face = openFace(fontName);
+  if (faces[numFaces].face == NULL) {
+    fprintf(stderr, "Warning: Could not load the font %s; using the built-in fonts\n", fontName);
+  }
+  return(faces[numFaces++].face);
+} /* findFace */
+
+
+/* Set the face to a pixel size, returning the height of a line of
+   text, or -1 if the face doesn't come in that size. */
+static int setFaceSize(FT_Face face, int size, int* ascent)
+{
+  if (FT_Set_Pixel_Sizes(face, 0, size) != 0) return(-1);
+  *ascent = (int)((face->size->metrics.ascender + 63) >> 6);
+  return(*ascent + (int)((-face->size->metrics.descender + 63) >> 6));
+} /* setFaceSize */
+
+
+/* Render one character, with the face already at the right size, as a
+   monochrome mask: the image is paletted, so there is nothing to
+   antialias with. Control characters are left blank. */
+static void renderGlyph(FT_Face face, int c, TTGLYPH_T* glyph)
+{
+  FT_GlyphSlot slot;
+  FT_Bitmap* bitmap;
+  int r, k;
+
+  memset(glyph, 0, sizeof(TTGLYPH_T));
+  if (c < ' ') return;
+  if (FT_Load_Char(face, (FT_ULong)c, FT_LOAD_RENDER | FT_LOAD_TARGET_MONO) != 0) return;
+
+  slot = face->glyph;
+  bitmap = &slot->bitmap;
+  glyph->advance = (int)((slot->advance.x + 32) >> 6);
+  glyph->xoffset = slot->bitmap_left;
+  glyph->yoffset = -slot->bitmap_top;
+  glyph->width = (int)bitmap->width;
+  glyph->height = (int)bitmap->rows;
+  if (glyph->width == 0 || glyph->height == 0) return;
+
+  glyph->mask = (unsigned char*)mymalloc((size_t)glyph->width * glyph->height);
+  for (r=0; r<glyph->height; r++) {
+    unsigned char* src = bitmap->buffer + r*bitmap->pitch;
+    unsigned char* dst = glyph->mask + r*glyph->width;
+    for (k=0; k<glyph->width; k++) {
+      if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO) {
+	dst[k] = (src[k >> 3] & (0x80 >> (k & 7))) ? 0xff : 0;
+      } else {
+	dst[k] = src[k] >= 128 ? 0xff : 0;
+      }
+    }
+  }
+} /* renderGlyph */
+#endif /* USE_FREETYPE */
+
+
+/* Turn an upright glyph a quarter turn counterclockwise: what was to
+   the right of the pen is now above it, what was below is to the
+   right. */
+static void rotateGlyph(TTGLYPH_T* upright, TTGLYPH_T* glyph)
+{
+  int r, c;
+
+  glyph->advance = upright->advance;
+  glyph->width = upright->height;
+  glyph->height = upright->width;
+  glyph->xoffset = upright->yoffset;
+  glyph->yoffset = -(upright->xoffset + upright->width - 1);
+  glyph->mask = NULL;
+  if (upright->mask == NULL) return;
+
+  glyph->mask = (unsigned char*)mymalloc((size_t)glyph->width * glyph->height);
+  for (r=0; r<glyph->height; r++) {
+    for (c=0; c<glyph->width; c++) {
+      glyph->mask[r*glyph->width + c] = upright->mask[c*upright->width + upright->width - 1 - r];
+    }
+  }
+} /* rotateGlyph */
+
+
+static TTFONT_T* findFont(char* fontName, int size, BOOLEAN_T vertical)
+{
+  int i;
+  for (i=0; i<numFonts; i++) {
+    if (fonts[i]->size == size && fonts[i]->vertical == vertical && strcmp(fonts[i]->name, fontName) == 0)
+      return(fonts[i]);
+  }
+  return(NULL);
+} /* findFont */
+
+
+/*****************************************************************************
+ * getTTFont
+ *****************************************************************************/
+TTFONT_T* getTTFont(char* fontName, int maxHeight, BOOLEAN_T vertical)
+{
+#ifdef USE_FREETYPE
+  FT_Face face;
+  TTFONT_T* font;
+  int size, height, ascent, c;
+
+  face = findFace(fontName);
+  if (face == NULL) return(NULL);
+
+  /* the largest size that fits */
+  for (size = maxHeight > TTFONT_MIN_SIZE ? maxHeight : TTFONT_MIN_SIZE; size > TTFONT_MIN_SIZE; size--) {
+    height = setFaceSize(face, size, &ascent);
+    if (height > 0 && height <= maxHeight) break;
+  }
+
+  font = findFont(fontName, size, vertical);
+  if (font != NULL) return(font);
+
+  height = setFaceSize(face, size, &ascent);
+  if (height < 0) {
+    fprintf(stderr, "Warning: The font %s doesn't come in a size that fits; using the built-in fonts\n", fontName);
+    return(NULL);
+  }
+  if (numFonts == MAXTTFONTS) die("Too many font sizes (at most %d)", MAXTTFONTS);
+
+  font = (TTFONT_T*)mycalloc(1, sizeof(TTFONT_T));
+  font->name = (char*)mymalloc(strlen(fontName) + 1);
+  strcpy(font->name, fontName);
+  font->size = size;
+  font->vertical = vertical;
+  font->height = height;
+  font->ascent = ascent;
+
+  if (vertical) {
+    /* made from the upright glyphs, without rendering them again */
+    TTFONT_T* upright = getTTFont(fontName, maxHeight, FALSE);
+    for (c=0; c<TTFONT_NUM_GLYPHS; c++) {
+      rotateGlyph(&upright->glyphs[c], &font->glyphs[c]);
+    }
+  } else {
+    for (c=0; c<TTFONT_NUM_GLYPHS; c++) {
+      renderGlyph(face, c, &font->glyphs[c]);
+    }
+  }
+  DEBUG_CODE(1, fprintf(stderr, "Rendered %s at %d pixels%s, line height %d\n", fontName, size, vertical ? " (vertical)" : "", height););
+
+  fonts[numFonts++] = font;
+  return(font);
+#else
+  static BOOLEAN_T warned = FALSE;
+  if (!warned) {
+    fprintf(stderr, "Warning: This matrix2png was built without FreeType, so -font %s is ignored\n", fontName);
+    warned = TRUE;
+  }
+  return(NULL);
+#endif
+} /* getTTFont */
+
+
+/*****************************************************************************
+ * ttStringWidth
+ *****************************************************************************/
+int ttStringWidth(TTFONT_T* font, char* string, int len)
+{
+  int width = 0;
+  int k;
+  for (k=0; k<len; k++) {
+    width += font->glyphs[(unsigned char)string[k]].advance;
+  }
+  return(width);
+} /* ttStringWidth */
+
+
+/*****************************************************************************
+ * ttDrawString
+ *****************************************************************************/
+void ttDrawString(gdImagePtr img, TTFONT_T* font, char* string, int len,
+		  int x, int y, unsigned char color,
+		  int clipX1, int clipY1, int clipX2, int clipY2)
+{
+  int k;
+  for (k=0; k<len; k++) {
+    TTGLYPH_T* glyph = &font->glyphs[(unsigned char)string[k]];
+    if (glyph->mask != NULL) {
+      blitMaskClipped(img, glyph->mask, glyph->width, glyph->height, x + glyph->xoffset, y + glyph->yoffset,
+		      color, clipX1, clipY1, clipX2, clipY2);
+    }
+    if (font->vertical) {
+      y -= glyph->advance;
+    } else {
+      x += glyph->advance;
+    }
+  }
+} /* ttDrawString */
+
+
+/*****************************************************************************
+ * freeTTFonts
+ *****************************************************************************/
+void freeTTFonts(void)
+{
+  int i, c;
+
+  for (i=0; i<numFonts; i++) {
+    for (c=0; c<TTFONT_NUM_GLYPHS; c++) {
+      myfree(fonts[i]->glyphs[c].mask);
+    }
+    myfree(fonts[i]->name);
+    myfree(fonts[i]);
+  }
+  numFonts = 0;
+
+#ifdef USE_FREETYPE
+  for (i=0; i<numFaces; i++) {
+    if (faces[i].face != NULL) FT_Done_Face(faces[i].face);
+    myfree(faces[i].name);
+  }
+  numFaces = 0;
+  if (library != NULL) {
+    FT_Done_FreeType(library);
+    library = NULL;
+  }
+#endif
+} /* freeTTFonts */
+
+/*
+ * ttfont.c
+ */
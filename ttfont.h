@@ -0,0 +1,93 @@
+/*****************************************************************************
+ * FILE: ttfont.h
+ * CREATE DATE: 10/2026
+ * PROJECT: PLOTKIT
+ * DESCRIPTION: TrueType (or any FreeType-readable) fonts for labels,
+ * with the glyphs cached per font, size and rotation.
+ *****************************************************************************/
+#ifndef TTFONT_H
+#define TTFONT_H
+
+#include "utils.h"
+#include "gd.h"
+
+#if defined(HAVE_LIBFREETYPE) && defined(HAVE_FT2BUILD_H)
+#define USE_FREETYPE
+#endif
+
+/* Labels are 8 bit text, taken as Latin-1, so each font has this
+   many glyphs. */
+#define TTFONT_NUM_GLYPHS 256
+
+/* how many font, size and rotation combinations are kept */
+#define MAXTTFONTS 32
+
+/* the smallest pixel size a font is used at */
+#define TTFONT_MIN_SIZE 6
+
+/* where to look for fonts given by name, when GDFONTPATH isn't set */
+#define TTFONT_DEFAULT_PATH "/usr/share/fonts/truetype:/usr/local/share/fonts:/usr/X11R6/lib/X11/fonts/TrueType:/usr/X11R6/lib/X11/fonts/truetype"
+
+/* A glyph as drawn: a mask (0xff where set) and where its top left
+   corner goes relative to the pen. */
+typedef struct ttglyph_t {
+  int advance;   /* how far the pen moves along the text, in pixels */
+  int width;     /* of the mask */
+  int height;
+  int xoffset;
+  int yoffset;
+  unsigned char* mask; /* NULL for blank glyphs */
+} TTGLYPH_T;
+
+/* A font at one pixel size, upright or turned a quarter turn
+   counterclockwise (reading upwards, as gdImageStringUp draws). */
+typedef struct ttfont_t {
+  char*     name;
+  int       size;    /* pixels per em */
+  BOOLEAN_T vertical;
+  int       height;  /* of a line of text, in pixels */
+  int       ascent;  /* from the top of the line to the baseline */
+  TTGLYPH_T glyphs[TTFONT_NUM_GLYPHS];
+} TTFONT_T;
+
+/*****************************************************************************
+ * The font fontName (a font file, or a name to find along GDFONTPATH)
+ * at the largest size whose lines are at most maxHeight pixels high,
+ * or at TTFONT_MIN_SIZE if none are. All its glyphs are rendered the
+ * first time a font, size and rotation is asked for and kept for the
+ * rest of the run. Returns NULL, with a warning the first time, if
+ * the font can't be loaded or FreeType isn't available.
+ *****************************************************************************/
+TTFONT_T* getTTFont(char* fontName,
+		    int maxHeight,
+		    BOOLEAN_T vertical);
+
+/*****************************************************************************
+ * Width (along the text) of the first len characters of a string.
+ *****************************************************************************/
+int ttStringWidth(TTFONT_T* font,
+		  char* string,
+		  int len);
+
+/*****************************************************************************
+ * Draw the first len characters of a string with the pen starting at
+ * (x, y) on the baseline, rightwards, or upwards for a vertical font,
+ * clipped to the rectangle from (clipX1, clipY1) up to but not
+ * including (clipX2, clipY2).
+ *****************************************************************************/
+void ttDrawString(gdImagePtr img,
+		  TTFONT_T* font,
+		  char* string,
+		  int len,
+		  int x,
+		  int y,
+		  unsigned char color,
+		  int clipX1,
+		  int clipY1,
+		  int clipX2,
+		  int clipY2);
+
+/* Let go of every cached font. */
+void freeTTFonts(void);
+
+#endif /* TTFONT_H */